@@ -0,0 +1,337 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "malloc369.h"
+#include "sim.h"
+#include "coremap.h"
+#include "analysis.h"
+
+size_t analysis_window = 0;
+
+static inline uint64_t hash64(uint64_t x)
+{
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+//---------------------------------------------------------------------
+// HyperLogLog. Each register holds the longest run of leading zeros (plus
+// one) seen in the hashes that map to it.
+
+#define FOOTPRINT_BITS 14 // 16384 registers, about 0.8% error
+#define WINDOW_BITS 12    // 4096 registers, about 1.6% error
+
+struct hll {
+	int bits;
+	unsigned char *reg;
+};
+
+static void hll_init(struct hll *h, int bits)
+{
+	h->bits = bits;
+	h->reg = malloc369((size_t)1 << bits);
+	memset(h->reg, 0, (size_t)1 << bits);
+}
+
+static void hll_clear(struct hll *h)
+{
+	memset(h->reg, 0, (size_t)1 << h->bits);
+}
+
+static void hll_add(struct hll *h, uint64_t hash)
+{
+	size_t idx = hash >> (64 - h->bits);
+	uint64_t rest = hash << h->bits;
+	unsigned char rank = rest ? __builtin_clzll(rest) + 1 : 64 - h->bits + 1;
+	if (rank > h->reg[idx]) {
+		h->reg[idx] = rank;
+	}
+}
+
+static double hll_count(const struct hll *h)
+{
+	size_t m = (size_t)1 << h->bits;
+	double sum = 0.0;
+	size_t zeros = 0;
+	for (size_t i = 0; i < m; ++i) {
+		sum += ldexp(1.0, -h->reg[i]);
+		zeros += (h->reg[i] == 0);
+	}
+	double estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+	if (estimate <= 2.5 * m && zeros > 0) {
+		// Linear counting is more accurate for small counts
+		estimate = m * log((double)m / zeros);
+	}
+	return estimate;
+}
+
+//---------------------------------------------------------------------
+// Last reference time of each sampled page. A page is sampled if its hash
+// is below sample_limit. When the table gets too full, the limit is
+// halved and pages that are no longer sampled are dropped, so counts from
+// sampled pages stand for 1 / sample_rate pages each.
+
+#define TABLE_BITS 20 // Room for about 750k sampled pages
+
+struct last_ref {
+	uint64_t key;  // Page key + 1, 0 if unused
+	uint64_t time;
+};
+
+static struct last_ref *table;
+static size_t table_size = (size_t)1 << TABLE_BITS;
+static size_t table_used;
+static uint64_t sample_limit;
+static double sample_rate;
+
+static struct last_ref *table_slot(struct last_ref *t, uint64_t key, uint64_t hash)
+{
+	size_t i = hash & (table_size - 1);
+	while (t[i].key != 0 && t[i].key != key + 1) {
+		i = (i + 1) & (table_size - 1);
+	}
+	return &t[i];
+}
+
+static void table_shrink(void)
+{
+	struct last_ref *old = table;
+	table = malloc369(table_size * sizeof(struct last_ref));
+	memset(table, 0, table_size * sizeof(struct last_ref));
+	sample_limit /= 2;
+	sample_rate /= 2;
+	table_used = 0;
+	for (size_t i = 0; i < table_size; ++i) {
+		if (old[i].key == 0) {
+			continue;
+		}
+		uint64_t hash = hash64(old[i].key - 1);
+		if (hash < sample_limit) {
+			*table_slot(table, old[i].key - 1, hash) = old[i];
+			++table_used;
+		}
+	}
+	free369(old);
+}
+
+//---------------------------------------------------------------------
+// Space-Saving. The pages with the most references, each with a count
+// that overestimates its references by at most its error.
+
+#define TOP_COUNTERS 64
+#define TOP_REPORTED 10
+
+struct counter {
+	uint64_t key;
+	size_t count;
+	size_t error;
+};
+
+static struct counter top[TOP_COUNTERS];
+static size_t top_used;
+
+static void top_add(uint64_t key)
+{
+	size_t min = 0;
+	for (size_t i = 0; i < top_used; ++i) {
+		if (top[i].key == key) {
+			top[i].count++;
+			return;
+		}
+		if (top[i].count < top[min].count) {
+			min = i;
+		}
+	}
+	if (top_used < TOP_COUNTERS) {
+		top[top_used++] = (struct counter){ key, 1, 0 };
+	} else {
+		// Take over the smallest counter, which bounds what we missed
+		top[min] = (struct counter){ key, top[min].count + 1, top[min].count };
+	}
+}
+
+static int compare_counters(const void *a, const void *b)
+{
+	const struct counter *ca = a;
+	const struct counter *cb = b;
+	return (ca->count < cb->count) - (ca->count > cb->count);
+}
+
+//---------------------------------------------------------------------
+
+#define GAP_BUCKETS 64 // Bucket b holds gaps in [2^b, 2^(b+1))
+
+static struct hll footprint;
+static struct hll windows[2]; // Staggered by half a window
+static size_t window_fill[2];
+static size_t num_windows;
+static double wss_min;
+static double wss_max;
+static double wss_sum;
+
+static double gap_counts[GAP_BUCKETS];
+static double first_refs;
+
+static uint64_t time_now;
+static size_t reads;
+static size_t writes;
+static int cur_pid;
+static uint64_t prev_key;
+static size_t page_changes;
+static size_t sequential;
+
+void analysis_init(void)
+{
+	hll_init(&footprint, FOOTPRINT_BITS);
+	for (int i = 0; i < 2; ++i) {
+		hll_init(&windows[i], WINDOW_BITS);
+	}
+	window_fill[0] = 0;
+	window_fill[1] = 0;
+	num_windows = 0;
+	wss_min = INFINITY;
+	wss_max = 0.0;
+	wss_sum = 0.0;
+
+	table = malloc369(table_size * sizeof(struct last_ref));
+	memset(table, 0, table_size * sizeof(struct last_ref));
+	table_used = 0;
+	sample_limit = UINT64_MAX;
+	sample_rate = 1.0;
+	prev_key = UINT64_MAX;
+}
+
+void analysis_destroy(void)
+{
+	free369(footprint.reg);
+	free369(windows[0].reg);
+	free369(windows[1].reg);
+	free369(table);
+}
+
+void analysis_process(int pid)
+{
+	cur_pid = pid;
+}
+
+void analysis_ref(char type, vaddr_t vaddr)
+{
+	uint64_t vpn = vaddr >> PAGE_SHIFT;
+	uint64_t key = ((uint64_t)cur_pid << 36) | vpn;
+	uint64_t hash = hash64(key);
+	++time_now;
+
+	if (type == 'S') {
+		++writes;
+	} else if (type == 'M') {
+		// Read, modify, write
+		++reads;
+		++writes;
+	} else {
+		++reads;
+	}
+
+	if (key != prev_key) {
+		if (prev_key != UINT64_MAX) {
+			++page_changes;
+			if (key == prev_key + 1 || key == prev_key - 1) {
+				++sequential;
+			}
+		}
+		prev_key = key;
+	}
+
+	hll_add(&footprint, hash);
+	top_add(key);
+
+	for (int i = 0; i < 2; ++i) {
+		// The second window starts half a window in
+		if (i == 1 && time_now <= analysis_window / 2) {
+			continue;
+		}
+		hll_add(&windows[i], hash);
+		if (++window_fill[i] == analysis_window) {
+			double wss = hll_count(&windows[i]);
+			wss_min = fmin(wss_min, wss);
+			wss_max = fmax(wss_max, wss);
+			wss_sum += wss;
+			++num_windows;
+			hll_clear(&windows[i]);
+			window_fill[i] = 0;
+		}
+	}
+
+	if (hash >= sample_limit) {
+		return;
+	}
+	struct last_ref *slot = table_slot(table, key, hash);
+	if (slot->key == 0) {
+		first_refs += 1.0 / sample_rate;
+		slot->key = key + 1;
+		slot->time = time_now;
+		if (++table_used > table_size / 4 * 3) {
+			table_shrink();
+		}
+		return;
+	}
+	uint64_t gap = time_now - slot->time;
+	gap_counts[63 - __builtin_clzll(gap)] += 1.0 / sample_rate;
+	slot->time = time_now;
+}
+
+void analysis_report(void)
+{
+	size_t refs = time_now;
+	printf("Total references: %zu\n", refs);
+	printf("Reads: %zu\n", reads);
+	printf("Writes: %zu\n", writes);
+	printf("Read/write ratio: %.4f\n", writes ? (double)reads / writes : 0.0);
+	if (sample_rate < 1.0) {
+		printf("Footprint: %.0f pages (estimated)\n", hll_count(&footprint));
+	} else {
+		printf("Footprint: %zu pages\n", table_used);
+	}
+	printf("Sequentiality: %.4f (%zu of %zu page changes to an adjacent page)\n",
+	       page_changes ? (double)sequential / page_changes : 0.0,
+	       sequential, page_changes);
+
+	if (num_windows > 0) {
+		printf("Working set size over %zu-reference windows: min %.0f, "
+		       "mean %.0f, max %.0f pages (%zu windows, estimated)\n",
+		       analysis_window, wss_min, wss_sum / num_windows, wss_max,
+		       num_windows);
+	} else {
+		printf("Working set size: trace is shorter than one %zu-reference window\n",
+		       analysis_window);
+	}
+
+	printf("Reuse gaps%s:\n", sample_rate < 1.0 ? " (sampled, estimated)" : "");
+	double reuses = 0.0;
+	for (int b = 0; b < GAP_BUCKETS; ++b) {
+		reuses += gap_counts[b];
+	}
+	for (int b = 0; b < GAP_BUCKETS; ++b) {
+		if (gap_counts[b] > 0) {
+			printf("\t%12llu - %-12llu %12.0f %8.4f%%\n",
+			       1ULL << b, (2ULL << b) - 1, gap_counts[b],
+			       gap_counts[b] / (reuses + first_refs) * 100.0);
+		}
+	}
+	printf("\t%-27s %12.0f %8.4f%%\n", "first reference", first_refs,
+	       refs ? first_refs / (reuses + first_refs) * 100.0 : 0.0);
+	if (sample_rate < 1.0) {
+		printf("Reuse gap sample rate: %g\n", sample_rate);
+	}
+
+	qsort(top, top_used, sizeof(struct counter), compare_counters);
+	printf("Hottest pages (references, at most error over):\n");
+	for (size_t i = 0; i < top_used && i < TOP_REPORTED; ++i) {
+		printf("\tpid %-8d vpn %-12llx %10zu (+%zu)\n",
+		       (int)(top[i].key >> 36),
+		       (unsigned long long)(top[i].key & ((1ULL << 36) - 1)),
+		       top[i].count, top[i].error);
+	}
+}
@@ -0,0 +1,37 @@
+#ifndef __ANALYSIS_H__
+#define __ANALYSIS_H__
+
+#include <stddef.h>
+#include "sim.h"
+
+// Trace analysis. Instead of simulating paging, sim can make one pass over
+// a trace and describe it, to help pick a memory size:
+//   - the footprint, in distinct pages
+//   - the working set size, the distinct pages in each window of
+//     analysis_window references, for windows starting every half window
+//   - the distribution of reuse gaps, the number of references between
+//     two references to the same page
+//   - the numbers of reads and writes
+//   - the most referenced pages
+//   - how sequential the trace is: the fraction of page changes that go
+//     to the next page up or down
+// Memory use is bounded no matter how long the trace is or how many pages
+// it touches. Distinct page counts come from HyperLogLog sketches, the
+// hottest pages from the Space-Saving algorithm, and reuse gaps from a
+// table of last reference times that is spatially sampled (as in SHARDS)
+// once the footprint outgrows it. Pages are identified by pid and VPN.
+
+// Window size in references, set by sim.c. 0 disables analysis mode.
+extern size_t analysis_window;
+
+extern void analysis_init(void);
+extern void analysis_destroy(void);
+
+// Called for each 'P' record and each reference in the trace.
+extern void analysis_process(int pid);
+extern void analysis_ref(char type, vaddr_t vaddr);
+
+// Print the results.
+extern void analysis_report(void);
+
+#endif /* __ANALYSIS_H__ */
@@ -0,0 +1,350 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "malloc369.h"
+#include "sim.h"
+#include "cache.h"
+#include "snapshot.h"
+
+#define NO_LINE UINT32_MAX
+
+// Line states for miss classification
+#define LINE_SEEN   0x1 // Cached at this level at some point
+#define LINE_SHADOW 0x2 // In the fully associative shadow cache
+
+struct cache_level {
+	size_t size;
+	size_t ways;
+	size_t line;
+	bool plru;
+	size_t sets;
+	unsigned line_shift;
+
+	// Ways of set s are at [s * ways, (s + 1) * ways)
+	uint32_t *tags;          // Physical line number, NO_LINE if unused
+	unsigned long *last_use; // For LRU
+	uint64_t *plru_bits;     // For pseudo-LRU, ways - 1 tree bits per set
+	unsigned long clock;
+
+	// Fully associative LRU cache with as many lines as this level, to
+	// tell conflict misses from capacity misses. It is a list through
+	// every physical line, most recent at shadow_head.
+	size_t nlines;           // Lines in physical memory
+	uint32_t *shadow_prev;
+	uint32_t *shadow_next;
+	uint32_t shadow_head;
+	uint32_t shadow_tail;
+	size_t shadow_used;
+	unsigned char *state;
+};
+
+int cache_levels = 0;
+struct cache_stats cache_stats[CACHE_MAX_LEVELS];
+
+static struct cache_level caches[CACHE_MAX_LEVELS];
+
+static bool is_pow2(size_t n)
+{
+	return n > 0 && (n & (n - 1)) == 0;
+}
+
+static int parse_level(const char *spec, const char *end, struct cache_level *c)
+{
+	char *p;
+	c->size = strtoul(spec, &p, 10);
+	if (*p == 'k' || *p == 'K') {
+		c->size *= 1024;
+		p++;
+	} else if (*p == 'm' || *p == 'M') {
+		c->size *= 1024 * 1024;
+		p++;
+	}
+	if (*p != ':') {
+		return -1;
+	}
+	c->ways = strtoul(p + 1, &p, 10);
+	if (*p != ':') {
+		return -1;
+	}
+	c->line = strtoul(p + 1, &p, 10);
+	c->plru = false;
+	if (p < end && *p == ':') {
+		p++;
+		if ((size_t)(end - p) == 4 && strncmp(p, "plru", 4) == 0) {
+			c->plru = true;
+		} else if ((size_t)(end - p) != 3 || strncmp(p, "lru", 3) != 0) {
+			return -1;
+		}
+		p = (char *)end;
+	}
+	if (p != end || !is_pow2(c->line) || c->ways == 0 ||
+	    c->size % (c->ways * c->line) != 0) {
+		return -1;
+	}
+	c->sets = c->size / (c->ways * c->line);
+	// Tree pseudo-LRU needs a full binary tree over the ways
+	if (!is_pow2(c->sets) || (c->plru && (!is_pow2(c->ways) || c->ways > 64))) {
+		return -1;
+	}
+	c->line_shift = __builtin_ctzl(c->line);
+	return 0;
+}
+
+int cache_parse(const char *spec)
+{
+	cache_levels = 0;
+	while (*spec) {
+		if (cache_levels == CACHE_MAX_LEVELS) {
+			return -1;
+		}
+		const char *end = strchr(spec, ',');
+		if (!end) {
+			end = spec + strlen(spec);
+		}
+		if (parse_level(spec, end, &caches[cache_levels]) != 0) {
+			return -1;
+		}
+		cache_levels++;
+		spec = (*end == ',') ? end + 1 : end;
+	}
+	return 0;
+}
+
+void cache_init(void)
+{
+	for (int l = 0; l < cache_levels; ++l) {
+		struct cache_level *c = &caches[l];
+		size_t nways = c->sets * c->ways;
+		c->tags = malloc369(nways * sizeof(uint32_t));
+		memset(c->tags, 0xff, nways * sizeof(uint32_t));
+		c->last_use = malloc369(nways * sizeof(unsigned long));
+		memset(c->last_use, 0, nways * sizeof(unsigned long));
+		c->plru_bits = malloc369(c->sets * sizeof(uint64_t));
+		memset(c->plru_bits, 0, c->sets * sizeof(uint64_t));
+		c->clock = 0;
+
+		c->nlines = (memsize * simpagesize + c->line - 1) >> c->line_shift;
+		c->shadow_prev = malloc369(c->nlines * sizeof(uint32_t));
+		c->shadow_next = malloc369(c->nlines * sizeof(uint32_t));
+		c->state = malloc369(c->nlines);
+		memset(c->state, 0, c->nlines);
+		c->shadow_head = NO_LINE;
+		c->shadow_tail = NO_LINE;
+		c->shadow_used = 0;
+		memset(&cache_stats[l], 0, sizeof(cache_stats[l]));
+	}
+}
+
+void cache_destroy(void)
+{
+	for (int l = 0; l < cache_levels; ++l) {
+		free369(caches[l].tags);
+		free369(caches[l].last_use);
+		free369(caches[l].plru_bits);
+		free369(caches[l].shadow_prev);
+		free369(caches[l].shadow_next);
+		free369(caches[l].state);
+	}
+}
+
+size_t cache_page_colors(void)
+{
+	if (cache_levels == 0) {
+		return 1;
+	}
+	struct cache_level *c = &caches[cache_levels - 1];
+	size_t colors = c->sets * c->line / simpagesize;
+	return colors > 0 ? colors : 1;
+}
+
+//---------------------------------------------------------------------
+// Shadow cache.
+
+static void shadow_unlink(struct cache_level *c, uint32_t line)
+{
+	uint32_t prev = c->shadow_prev[line];
+	uint32_t next = c->shadow_next[line];
+	if (prev != NO_LINE) {
+		c->shadow_next[prev] = next;
+	} else {
+		c->shadow_head = next;
+	}
+	if (next != NO_LINE) {
+		c->shadow_prev[next] = prev;
+	} else {
+		c->shadow_tail = prev;
+	}
+}
+
+// Move line to the front of the shadow cache. Returns true if it was there.
+static bool shadow_access(struct cache_level *c, uint32_t line)
+{
+	bool hit = c->state[line] & LINE_SHADOW;
+	if (hit) {
+		shadow_unlink(c, line);
+	} else {
+		if (c->shadow_used == c->sets * c->ways) {
+			uint32_t victim = c->shadow_tail;
+			shadow_unlink(c, victim);
+			c->state[victim] &= ~LINE_SHADOW;
+		} else {
+			c->shadow_used++;
+		}
+		c->state[line] |= LINE_SHADOW;
+	}
+	c->shadow_prev[line] = NO_LINE;
+	c->shadow_next[line] = c->shadow_head;
+	if (c->shadow_head != NO_LINE) {
+		c->shadow_prev[c->shadow_head] = line;
+	} else {
+		c->shadow_tail = line;
+	}
+	c->shadow_head = line;
+	return hit;
+}
+
+//---------------------------------------------------------------------
+// Replacement within a set.
+
+// Point the tree bits on the path to 'way' away from it
+static void plru_touch(struct cache_level *c, size_t set, size_t way)
+{
+	uint64_t bits = c->plru_bits[set];
+	size_t node = 0;
+	for (size_t span = c->ways / 2; span > 0; span /= 2) {
+		size_t right = (way & span) != 0;
+		if (right) {
+			bits &= ~((uint64_t)1 << node);
+		} else {
+			bits |= (uint64_t)1 << node;
+		}
+		node = 2 * node + 1 + right;
+	}
+	c->plru_bits[set] = bits;
+}
+
+static size_t plru_victim(struct cache_level *c, size_t set)
+{
+	uint64_t bits = c->plru_bits[set];
+	size_t node = 0;
+	size_t way = 0;
+	for (size_t span = c->ways / 2; span > 0; span /= 2) {
+		size_t right = (bits >> node) & 1;
+		way = way * 2 + right;
+		node = 2 * node + 1 + right;
+	}
+	return way;
+}
+
+static void touch(struct cache_level *c, size_t set, size_t way)
+{
+	if (c->plru) {
+		plru_touch(c, set, way);
+	} else {
+		c->last_use[set * c->ways + way] = ++c->clock;
+	}
+}
+
+static size_t victim(struct cache_level *c, size_t set)
+{
+	uint32_t *tags = &c->tags[set * c->ways];
+	for (size_t i = 0; i < c->ways; ++i) {
+		if (tags[i] == NO_LINE) {
+			return i;
+		}
+	}
+	if (c->plru) {
+		return plru_victim(c, set);
+	}
+	unsigned long *last_use = &c->last_use[set * c->ways];
+	size_t oldest = 0;
+	for (size_t i = 1; i < c->ways; ++i) {
+		if (last_use[i] < last_use[oldest]) {
+			oldest = i;
+		}
+	}
+	return oldest;
+}
+
+//---------------------------------------------------------------------
+
+// Returns true on a hit at this level
+static bool level_access(int l, size_t paddr)
+{
+	struct cache_level *c = &caches[l];
+	struct cache_stats *stats = &cache_stats[l];
+	uint32_t line = paddr >> c->line_shift;
+	size_t set = line & (c->sets - 1);
+	uint32_t *tags = &c->tags[set * c->ways];
+
+	bool shadow_hit = shadow_access(c, line);
+	for (size_t i = 0; i < c->ways; ++i) {
+		if (tags[i] == line) {
+			stats->hits++;
+			touch(c, set, i);
+			return true;
+		}
+	}
+
+	if (!(c->state[line] & LINE_SEEN)) {
+		stats->compulsory++;
+		c->state[line] |= LINE_SEEN;
+	} else if (shadow_hit) {
+		stats->conflict++;
+	} else {
+		stats->capacity++;
+	}
+	size_t way = victim(c, set);
+	tags[way] = line;
+	touch(c, set, way);
+	return false;
+}
+
+void cache_access(size_t paddr)
+{
+	for (int l = 0; l < cache_levels && !level_access(l, paddr); ++l) {
+	}
+}
+
+// Snapshots. Only the state is saved, the geometry comes from the options.
+void cache_save(void)
+{
+	for (int l = 0; l < cache_levels; ++l) {
+		struct cache_level *c = &caches[l];
+		SNAP_WRITE(cache_stats[l]);
+		SNAP_WRITE(c->clock);
+		snap_write(c->tags, c->sets * c->ways * sizeof(uint32_t));
+		snap_write(c->last_use, c->sets * c->ways * sizeof(unsigned long));
+		snap_write(c->plru_bits, c->sets * sizeof(uint64_t));
+		snap_write(c->state, c->nlines);
+		SNAP_WRITE(c->shadow_used);
+		// The shadow cache from least to most recent, so that restoring
+		// it is just a matter of accessing the lines in order
+		for (uint32_t line = c->shadow_tail; line != NO_LINE; line = c->shadow_prev[line]) {
+			SNAP_WRITE(line);
+		}
+	}
+}
+
+void cache_restore(void)
+{
+	for (int l = 0; l < cache_levels; ++l) {
+		struct cache_level *c = &caches[l];
+		size_t shadow_used;
+		SNAP_READ(cache_stats[l]);
+		SNAP_READ(c->clock);
+		snap_read(c->tags, c->sets * c->ways * sizeof(uint32_t));
+		snap_read(c->last_use, c->sets * c->ways * sizeof(unsigned long));
+		snap_read(c->plru_bits, c->sets * sizeof(uint64_t));
+		snap_read(c->state, c->nlines);
+		SNAP_READ(shadow_used);
+		for (size_t i = 0; i < c->nlines; ++i) {
+			c->state[i] &= ~LINE_SHADOW;
+		}
+		for (size_t i = 0; i < shadow_used; ++i) {
+			uint32_t line;
+			SNAP_READ(line);
+			shadow_access(c, line);
+		}
+	}
+}
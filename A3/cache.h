@@ -0,0 +1,50 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Simulated CPU caches, fed by the physical address of every reference:
+// the offset of the byte in physmem, frame * simpagesize + offset. Up to
+// CACHE_MAX_LEVELS levels, each set-associative with its own size,
+// associativity, line size and replacement (LRU, or tree pseudo-LRU).
+// A level is only accessed on a miss in the level above it, and every
+// level allocates on both reads and writes.
+//
+// Misses are classified the usual way: compulsory if the line was never
+// cached at that level before, conflict if a fully associative LRU cache of
+// the same capacity would have hit, and capacity otherwise. Since placement
+// in the caches depends on which frames pages land in, this shows how the
+// frame allocator and replacement algorithm affect cache behaviour.
+
+#define CACHE_MAX_LEVELS 2
+
+struct cache_stats {
+	size_t hits;
+	size_t compulsory;
+	size_t capacity;
+	size_t conflict;
+};
+
+// Number of levels configured by cache_parse(), 0 if the caches are off
+extern int cache_levels;
+extern struct cache_stats cache_stats[CACHE_MAX_LEVELS];
+
+// Parse a comma-separated list of levels, L1 first, each
+// "size:ways:line[:lru|plru]". size may have a k or m suffix. Sets the
+// geometry of the caches, which are created by cache_init().
+// Return: 0 on success, -1 if spec is malformed or a level is not valid.
+extern int cache_parse(const char *spec);
+
+// Create the caches, once memsize and simpagesize are known.
+extern void cache_init(void);
+extern void cache_destroy(void);
+
+// Number of page colors in the last level: the number of frames that fit
+// in one way of it, at least 1.
+extern size_t cache_page_colors(void);
+
+// Simulate an access to the byte at physical address paddr.
+extern void cache_access(size_t paddr);
+
+#endif /* __CACHE_H__ */
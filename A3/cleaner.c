@@ -0,0 +1,88 @@
+#include "sim.h"
+#include "coremap.h"
+#include "cleaner.h"
+#include "snapshot.h"
+
+size_t cleaner_interval = 0;
+size_t cleaner_low = 0;
+size_t cleaner_high = 0;
+
+size_t cleaner_runs = 0;
+size_t cleaned_count = 0;
+size_t cleaned_evict_count = 0;
+size_t cleaned_wasted_count = 0;
+double cleaner_write_time = 0.0;
+
+static size_t cleaner_hand;
+static size_t cleaner_countdown;
+
+/* Scan frames ahead of the cleaner hand, writing out dirty pages, until
+ * enough frames are clean or we have looked at every frame once. A page
+ * that can't be written (swap is full) ends the scan, and is left for
+ * eviction to write out, or report.
+ *
+ * The hand sweeps the coremap in frame order, like the rr and clock hands
+ * do, and it skips over pages that were referenced recently, since those
+ * are the least likely eviction candidates (and the most likely to be
+ * dirtied again right away).
+ */
+static void cleaner_run(void)
+{
+	++cleaner_runs;
+	for (size_t scanned = 0; scanned < memsize; ++scanned) {
+		if (memsize - dirty_frame_count >= cleaner_high) {
+			break;
+		}
+		struct frame *f = &coremap[cleaner_hand];
+		cleaner_hand = (cleaner_hand + 1) % memsize;
+		if (!f->in_use || f->pinned || !is_dirty(f->pte) ||
+		    get_referenced(f->pte)) {
+			continue;
+		}
+
+		double start = get_time();
+		bool cleaned = handle_clean(f->pte);
+		cleaner_write_time += get_time() - start;
+		if (!cleaned) {
+			break;
+		}
+		++cleaned_count;
+	}
+}
+
+/* Called on every reference. Wakes the cleaner up every cleaner_interval
+ * references, if the number of frames that can be reclaimed without
+ * writing to swap is below the low watermark.
+ */
+void cleaner_tick(void)
+{
+	if (cleaner_interval == 0 || ++cleaner_countdown < cleaner_interval) {
+		return;
+	}
+	cleaner_countdown = 0;
+	if (memsize - dirty_frame_count < cleaner_low) {
+		cleaner_run();
+	}
+}
+
+void cleaner_save(void)
+{
+	SNAP_WRITE(cleaner_hand);
+	SNAP_WRITE(cleaner_countdown);
+	SNAP_WRITE(cleaner_runs);
+	SNAP_WRITE(cleaned_count);
+	SNAP_WRITE(cleaned_evict_count);
+	SNAP_WRITE(cleaned_wasted_count);
+	SNAP_WRITE(cleaner_write_time);
+}
+
+void cleaner_restore(void)
+{
+	SNAP_READ(cleaner_hand);
+	SNAP_READ(cleaner_countdown);
+	SNAP_READ(cleaner_runs);
+	SNAP_READ(cleaned_count);
+	SNAP_READ(cleaned_evict_count);
+	SNAP_READ(cleaned_wasted_count);
+	SNAP_READ(cleaner_write_time);
+}
@@ -0,0 +1,28 @@
+#ifndef __CLEANER_H__
+#define __CLEANER_H__
+
+#include <stddef.h>
+
+// Background page cleaner. Every cleaner_interval references, if fewer
+// than cleaner_low frames could be reclaimed without a swap write (that
+// is, they are free or clean), the cleaner writes dirty pages to swap and
+// marks them clean until cleaner_high frames are clean. This keeps the
+// swap writes off the fault path for most evictions.
+
+// Configuration, set by sim.c. An interval of 0 disables the cleaner.
+extern size_t cleaner_interval;
+extern size_t cleaner_low;
+extern size_t cleaner_high;
+
+// Counters for the cleaner. Set in cleaner.c and pagetable.c, reported
+// by sim.c
+extern size_t cleaner_runs;        // times the cleaner woke up
+extern size_t cleaned_count;       // pages written to swap by the cleaner
+extern size_t cleaned_evict_count; // cleaned pages later evicted clean
+extern size_t cleaned_wasted_count;// cleaned pages dirtied again
+extern double cleaner_write_time;  // time spent writing cleaned pages
+
+// Called from find_frame_number on every reference.
+extern void cleaner_tick(void);
+
+#endif /* __CLEANER_H__ */
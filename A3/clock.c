@@ -1,5 +1,6 @@
 #include "sim.h"
 #include "coremap.h"
+#include "snapshot.h"
 
 static int clock_hand;
 
@@ -12,6 +13,9 @@ int clock_evict(void)
     while (true) {
         int previous = clock_hand;
         clock_hand = (clock_hand + 1) % memsize;
+        if (!evictable(previous)) {
+            continue;
+        }
         if (get_referenced(coremap[previous].pte)){
             set_referenced(coremap[previous].pte, 0);
         } else {
@@ -31,6 +35,47 @@ void clock_ref(int frame, vaddr_t vaddr)
     set_referenced(coremap[frame].pte, 1);
 }
 
+/* This function is called when a page is read ahead into frame, before it
+ * is used. It stays unreferenced, so the hand takes it on its next pass
+ * unless it is used by then.
+ */
+void clock_prefetch(int frame, vaddr_t vaddr)
+{
+    (void)vaddr;
+    set_referenced(coremap[frame].pte, 0);
+}
+
+/* This function is called when the page in frame is freed without being
+ * evicted, to drop any information the algorithm keeps about it.
+ */
+void clock_drop(int frame)
+{
+    (void)frame;
+}
+
+/* This function is called when the pages in frames a and b trade places,
+ * where b may be free. The referenced bits move with the page table
+ * entries.
+ */
+void clock_exchange(int a, int b)
+{
+    (void)a;
+    (void)b;
+}
+
+/* Save or restore the algorithm's state in a snapshot. The referenced
+ * bits are saved with the page table.
+ */
+void clock_save(void)
+{
+    SNAP_WRITE(clock_hand);
+}
+
+void clock_restore(void)
+{
+    SNAP_READ(clock_hand);
+}
+
 /* Initialize any data structures needed for this replacement algorithm. */
 void clock_init(void)
 {
@@ -1,7 +1,77 @@
 #include "sim.h"
 #include "coremap.h"
+#include "malloc369.h"
+#include "snapshot.h"
+#include "tier.h"
 #include <string.h>
 
+enum frame_policy frame_policy = FRAME_FIRST;
+size_t frame_colors = 1;
+size_t color_match_count = 0;
+size_t color_fallback_count = 0;
+
+// Free frames. For FRAME_COLOR, each color has a stack of free frames,
+// linked through free_next.
+static size_t free_count;
+static int *free_next;
+static int *color_head;
+
+#define NO_FRAME -1
+
+static void push_free(int frame)
+{
+	size_t color = frame % frame_colors;
+	free_next[frame] = color_head[color];
+	color_head[color] = frame;
+}
+
+void frame_alloc_init(void)
+{
+	free_count = memsize;
+	if (frame_policy != FRAME_COLOR) {
+		return;
+	}
+	free_next = malloc369(memsize * sizeof(int));
+	color_head = malloc369(frame_colors * sizeof(int));
+	for (size_t c = 0; c < frame_colors; ++c) {
+		color_head[c] = NO_FRAME;
+	}
+	// Lowest numbered frames on top
+	for (size_t f = memsize; f > 0; --f) {
+		push_free(f - 1);
+	}
+}
+
+void frame_alloc_destroy(void)
+{
+	if (frame_policy == FRAME_COLOR) {
+		free369(free_next);
+		free369(color_head);
+	}
+}
+
+// Take a free frame of the page's color, or failing that, of the next
+// color that has one.
+static int take_colored(struct pt_entry_s *pte)
+{
+	size_t color = get_vpn(pte) % frame_colors;
+	for (size_t i = 0; i < frame_colors; ++i) {
+		size_t c = (color + i) % frame_colors;
+		int frame = color_head[c];
+		if (frame != NO_FRAME) {
+			color_head[c] = free_next[frame];
+			if (i == 0) {
+				++color_match_count;
+			} else {
+				++color_fallback_count;
+			}
+			return frame;
+		}
+	}
+	assert(false);
+	return NO_FRAME;
+}
+
 /*
  * Allocates a frame to be used for the virtual page represented by pte.
  * If all frames are in use, calls the replacement algorithm's evict_func to
@@ -9,20 +79,35 @@
  * page table entry for victim to indicate that virtual page is no longer in
  * (simulated) physical memory.
  */
+int evict_asid = -1;
+
 int allocate_frame(struct pt_entry_s *pte)
 {
 	int frame = -1;
-	for (size_t i = 0; i < memsize; ++i) {
-		if (!coremap[i].in_use) {
-			frame = i;
-			break;
+	if (free_count > 0) {
+		--free_count;
+		if (num_tiers > 0) {
+			frame = tier_alloc();
+		} else if (frame_policy == FRAME_COLOR) {
+			frame = take_colored(pte);
+		} else {
+			for (size_t i = 0; i < memsize; ++i) {
+				if (!coremap[i].in_use) {
+					frame = i;
+					break;
+				}
+			}
 		}
 	}
 
 	if (frame == -1) { // Didn't find a free page.
-		// Call replacement algorithm's evict function to select victim
+		// Call replacement algorithm's evict function to select victim,
+		// restricted to the faulting process's frames if the replacement
+		// scope is local.
+		evict_asid = victim_asid();
 		frame = evict_func();
-		assert(frame != -1);
+		assert(frame != -1 && evictable(frame));
+		evict_asid = -1;
 
 		// All frames were in use, so victim frame must hold some page
 		// Write victim page to swap, if needed, and update page table
@@ -34,10 +119,74 @@ int allocate_frame(struct pt_entry_s *pte)
 	// Record information for virtual page that will now be stored in frame
 	coremap[frame].in_use = true;
 	coremap[frame].pte = pte;
+	if (num_tiers > 0) {
+		tier_placed(frame);
+	}
 
 	return frame;
 }
 
+/*
+ * Frees a frame whose page is being thrown away rather than evicted, e.g.
+ * because its process exited. The page table entry must be updated by the
+ * caller.
+ */
+void free_frame(int frame)
+{
+	drop_func(frame);
+	coremap[frame].in_use = false;
+	coremap[frame].pte = NULL;
+	++free_count;
+	if (num_tiers > 0) {
+		tier_free(frame);
+	} else if (frame_policy == FRAME_COLOR) {
+		push_free(frame);
+	}
+}
+
+// Snapshots. Saved after the coremap, which gives the number of free frames.
+void frame_alloc_save(void)
+{
+	if (frame_policy != FRAME_COLOR) {
+		return;
+	}
+	SNAP_WRITE(color_match_count);
+	SNAP_WRITE(color_fallback_count);
+	for (size_t c = 0; c < frame_colors; ++c) {
+		for (int f = color_head[c]; f != NO_FRAME; f = free_next[f]) {
+			SNAP_WRITE(f);
+		}
+		int end = NO_FRAME;
+		SNAP_WRITE(end);
+	}
+}
+
+void frame_alloc_restore(void)
+{
+	free_count = 0;
+	for (size_t f = 0; f < memsize; ++f) {
+		if (!coremap[f].in_use) {
+			++free_count;
+		}
+	}
+	if (frame_policy != FRAME_COLOR) {
+		return;
+	}
+	SNAP_READ(color_match_count);
+	SNAP_READ(color_fallback_count);
+	for (size_t c = 0; c < frame_colors; ++c) {
+		// Rebuild the stack in the order it was saved, top first
+		int *link = &color_head[c];
+		for (;;) {
+			SNAP_READ(*link);
+			if (*link == NO_FRAME) {
+				break;
+			}
+			link = &free_next[*link];
+		}
+	}
+}
+
 /*
  * Initializes the content of a (simulated) physical memory frame when it
  * is first allocated for some virtual address. Just like in a real OS, we
@@ -46,8 +195,8 @@ int allocate_frame(struct pt_entry_s *pte)
 void init_frame(int frame)
 {
 	// Calculate pointer to start of frame in (simulated) physical memory
-	unsigned char *mem_ptr = &physmem[frame * SIMPAGESIZE];
-	memset(mem_ptr, 0, SIMPAGESIZE); // zero-fill the frame
+	unsigned char *mem_ptr = &physmem[frame * simpagesize];
+	memset(mem_ptr, 0, simpagesize); // zero-fill the frame
 }
 
 
@@ -64,5 +213,5 @@ unsigned char *find_physpage(vaddr_t vaddr, char type)
 	ref_func(frame, vaddr);
 
 	// Return pointer into (simulated) physical memory at start of frame
-	return &physmem[frame * SIMPAGESIZE];
+	return &physmem[frame * simpagesize];
 }
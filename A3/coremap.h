@@ -29,6 +29,8 @@ struct pt_entry_s;
  */
 struct frame {
 	bool in_use;    // true if frame is allocated, false if frame is free
+	bool pinned;    // true if frame must not be chosen for eviction
+	unsigned short asid;    // Address space of the page stored in frame
 	struct pt_entry_s *pte; // Pointer back to pagetable entry (pte) for page
 	                        // stored in this frame
 	list_entry framelist_entry;
@@ -38,12 +40,42 @@ extern struct frame *coremap;
 
 // Coremap functions that your pagetable should call.
 int allocate_frame(struct pt_entry_s * pte);
+void free_frame(int frame);
 void init_frame(int frame);
 
+// How allocate_frame() picks a free frame. FRAME_FIRST takes the lowest
+// numbered one. FRAME_COLOR keeps a free list per cache color, where the
+// color of frame f is f % frame_colors, and takes a frame of the same
+// color as the virtual page if there is one, so that pages that are
+// adjacent in virtual memory don't compete for the same cache sets.
+// Either way, a victim is only evicted when no frame is free.
+enum frame_policy { FRAME_FIRST, FRAME_COLOR };
+extern enum frame_policy frame_policy; // Set by sim.c
+extern size_t frame_colors;            // Set by sim.c for FRAME_COLOR
+extern size_t color_match_count;       // Allocations that matched the color
+extern size_t color_fallback_count;    // Allocations that took another color
+
+// Set up the free lists, once the coremap is allocated, and tear them down.
+void frame_alloc_init(void);
+void frame_alloc_destroy(void);
+
+// Replacement algorithms must only choose victims for which evictable()
+// returns true. It rules out pinned frames and, with local replacement,
+// frames that belong to other processes.
+extern int evict_asid; // ASID victims must belong to, or -1 for any
+static inline bool evictable(int frame)
+{
+	return !coremap[frame].pinned &&
+	       (evict_asid < 0 || coremap[frame].asid == evict_asid);
+}
+
 // Accessor functions for coremap, for pagetable specific handling
 // logic that you need to implement
 void handle_evict(struct pt_entry_s * pte);
+bool handle_clean(struct pt_entry_s * pte);
+void exchange_frames(int a, int b);
 int find_frame_number(vaddr_t vaddr, char type);
+int victim_asid(void);
 
 // Accessor functions for page table entries, to allow replacement
 // algorithms to obtain information from a PTE, without depending
@@ -52,22 +84,33 @@ bool is_valid(struct pt_entry_s *pte);
 bool is_dirty(struct pt_entry_s *pte);
 bool get_referenced(struct pt_entry_s *pte);
 void set_referenced(struct pt_entry_s *pte, bool val);
+vaddr_t get_vpn(struct pt_entry_s *pte);
 
 // The replacement algorithms.
 #define REPLACEMENT_ALGORITHMS \
 	RA(rand) \
 	RA(rr) \
 	RA(clock) \
-	RA(s2q) 
+	RA(s2q) \
+	RA(gclock) \
+	RA(lrfu)
 // no longer part of the assignment: lru, mru, opt
 
+// LRFU's decay rate, set by sim.c: 0 for LFU, up to 1 for LRU.
+extern double lrfu_lambda;
+
 // Replacement algorithm functions.
 // These may not need to do anything for some algorithms.
 #define RA(name) \
 	void name ## _init(void); \
 	void name ## _cleanup(void); \
 	void name ## _ref(int frame, vaddr_t vaddr); \
-	int name ## _evict(void);
+	void name ## _prefetch(int frame, vaddr_t vaddr); \
+	int name ## _evict(void); \
+	void name ## _drop(int frame); \
+	void name ## _exchange(int a, int b); \
+	void name ## _save(void); \
+	void name ## _restore(void);
 REPLACEMENT_ALGORITHMS
 #undef RA
 
@@ -0,0 +1,57 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cost.h"
+
+// Defaults are rough figures for DRAM, a 4-level page walk that mostly
+// hits in the caches, zeroing a 4 KiB page, an NVMe SSD, compressing or
+// decompressing a 4 KiB page, and copying a 4 KiB page between memory
+// tiers.
+struct cost_model cost_model = {
+	.hit = 100.0,
+	.tlb_miss = 30.0,
+	.zero_fill = 1000.0,
+	.swap_read = 80000.0,
+	.swap_write = 100000.0,
+	.pool = 2000.0,
+	.migrate = 2000.0,
+};
+
+double simulated_ns = 0.0;
+
+int cost_parse(const char *spec)
+{
+	static const struct {
+		const char *name;
+		double *field;
+	} names[] = {
+		{ "hit", &cost_model.hit },
+		{ "tlb", &cost_model.tlb_miss },
+		{ "zero", &cost_model.zero_fill },
+		{ "read", &cost_model.swap_read },
+		{ "write", &cost_model.swap_write },
+		{ "pool", &cost_model.pool },
+		{ "migrate", &cost_model.migrate },
+	};
+
+	while (*spec) {
+		const char *eq = strchr(spec, '=');
+		if (!eq) {
+			return -1;
+		}
+		double *field = NULL;
+		for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+			if (strlen(names[i].name) == (size_t)(eq - spec) &&
+			    strncmp(names[i].name, spec, eq - spec) == 0) {
+				field = names[i].field;
+			}
+		}
+		char *end;
+		double ns = strtod(eq + 1, &end);
+		if (!field || end == eq + 1 || ns < 0 || (*end != ',' && *end != '\0')) {
+			return -1;
+		}
+		*field = ns;
+		spec = (*end == ',') ? end + 1 : end;
+	}
+	return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef __COST_H__
+#define __COST_H__
+
+// Latency cost model. Each event in the simulation is charged a fixed
+// number of nanoseconds, and the sum is reported as the simulated run time
+// along with the average memory access time (AMAT). This ranks policies by
+// how long their paging would take rather than by raw miss counts: a dirty
+// eviction costs a swap write on top of the read for the faulting page.
+// Only I/O the fault path waits for is charged: pages kept in the
+// compressed pool cost a compression instead, and writes that go into the
+// writeback queue, or are made by the cleaner, are off the fault path.
+
+struct cost_model {
+	double hit;        // every memory access
+	double tlb_miss;   // page table walk after a TLB miss (only with -t)
+	double zero_fill;  // zeroing (or copying, for copy-on-write) a frame
+	double swap_read;  // reading a page, or a readahead run, from swap
+	double swap_write; // writing a dirty page to swap on eviction
+	double pool;       // compressing a page into, or out of, the pool (only with -z)
+	double migrate;    // copying a page to another memory tier (only with -n)
+};
+
+// Costs in nanoseconds, set by sim.c
+extern struct cost_model cost_model;
+
+// Simulated time so far, in nanoseconds. Charged in pagetable.c
+extern double simulated_ns;
+
+// Parse a comma-separated list of name=ns pairs, where name is one of hit,
+// tlb, zero, read, write, pool or migrate, and update cost_model.
+// Return: 0 on success, -1 if spec is malformed.
+extern int cost_parse(const char *spec);
+
+#endif /* __COST_H__ */
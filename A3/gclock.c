@@ -0,0 +1,101 @@
+#include <string.h>
+#include "malloc369.h"
+#include "sim.h"
+#include "coremap.h"
+#include "snapshot.h"
+
+#define GCLOCK_MAX 8 // References a page can bank against the hand
+
+static int gclock_hand;
+static unsigned char *gclock_count; // Per frame, beside the coremap
+
+/* Page to evict is chosen using the GCLOCK (generalized CLOCK) algorithm.
+ * Each frame has a counter of references instead of a referenced bit, and
+ * the hand decrements counters until it finds one at zero, so a page
+ * referenced many times survives several sweeps of the hand.
+ * Returns the page frame number (which is also the index in the coremap)
+ * for the page that is to be evicted.
+ */
+int gclock_evict(void)
+{
+    while (true) {
+        int previous = gclock_hand;
+        gclock_hand = (gclock_hand + 1) % memsize;
+        if (!evictable(previous)) {
+            continue;
+        }
+        if (gclock_count[previous] > 0) {
+            gclock_count[previous]--;
+        } else {
+            return previous;
+        }
+    }
+}
+
+/* This function is called on each access to a page to update any information
+ * needed by the GCLOCK algorithm.
+ * Input: The page table entry and full virtual address (not just VPN)
+ * for the page that is being accessed.
+ */
+void gclock_ref(int frame, vaddr_t vaddr)
+{
+    (void)vaddr;
+    if (gclock_count[frame] < GCLOCK_MAX) {
+        gclock_count[frame]++;
+    }
+}
+
+/* This function is called when a page is read ahead into frame, before it
+ * is used. It starts with no references banked.
+ */
+void gclock_prefetch(int frame, vaddr_t vaddr)
+{
+    (void)vaddr;
+    gclock_count[frame] = 0;
+}
+
+/* This function is called when the page in frame is freed without being
+ * evicted, to drop any information the algorithm keeps about it.
+ */
+void gclock_drop(int frame)
+{
+    gclock_count[frame] = 0;
+}
+
+/* This function is called when the pages in frames a and b trade places,
+ * where b may be free, to move any information the algorithm keeps about
+ * them.
+ */
+void gclock_exchange(int a, int b)
+{
+    unsigned char count = gclock_count[a];
+    gclock_count[a] = gclock_count[b];
+    gclock_count[b] = count;
+}
+
+/* Save or restore the algorithm's state in a snapshot. */
+void gclock_save(void)
+{
+    SNAP_WRITE(gclock_hand);
+    snap_write(gclock_count, memsize);
+}
+
+void gclock_restore(void)
+{
+    SNAP_READ(gclock_hand);
+    snap_read(gclock_count, memsize);
+}
+
+/* Initialize any data structures needed for this replacement algorithm. */
+void gclock_init(void)
+{
+    gclock_hand = 0;
+    gclock_count = malloc369(memsize);
+    memset(gclock_count, 0, memsize);
+}
+
+/* Cleanup any data structures created in gclock_init(). */
+void gclock_cleanup(void)
+{
+    free369(gclock_count);
+}
@@ -0,0 +1,134 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "malloc369.h"
+#include "sim.h"
+#include "swap.h"
+#include "interval.h"
+#include "snapshot.h"
+
+#define INTERVAL_BUFSIZE (64 * 1024)
+#define INTERVAL_MAXREC 256 // Longest record we ever format
+
+size_t interval_length = 0;
+bool interval_json = false;
+size_t interval_next = 0;
+
+static int interval_fd = -1;
+static char *buf;
+static size_t buflen;
+static off_t written; // Bytes written to the file so far
+
+// Counter values at the end of the previous interval
+static size_t last_refs;
+static size_t last_hits;
+static size_t last_misses;
+static size_t last_clean;
+static size_t last_dirty;
+
+static void interval_flush(void)
+{
+	size_t done = 0;
+	while (done < buflen) {
+		ssize_t n = write(interval_fd, buf + done, buflen - done);
+		if (n < 0) {
+			perror("interval_flush");
+			break;
+		}
+		done += n;
+	}
+	written += done;
+	buflen = 0;
+}
+
+int interval_open(const char *path, bool resume)
+{
+	if (strcmp(path, "-") == 0) {
+		interval_fd = STDOUT_FILENO;
+	} else {
+		interval_fd = open(path, O_WRONLY | O_CREAT | (resume ? 0 : O_TRUNC), 0644);
+		if (interval_fd < 0) {
+			perror(path);
+			return -1;
+		}
+	}
+	buf = malloc369(INTERVAL_BUFSIZE);
+	buflen = 0;
+	written = 0;
+	interval_next = interval_length;
+	if (!interval_json && !resume) {
+		buflen = snprintf(buf, INTERVAL_BUFSIZE, "refs,hits,misses,"
+		                  "clean_evictions,dirty_evictions,resident,swap_slots\n");
+	}
+	return 0;
+}
+
+void interval_record(void)
+{
+	if (buflen + INTERVAL_MAXREC > INTERVAL_BUFSIZE) {
+		interval_flush();
+	}
+	const char *fmt = interval_json ?
+		"{\"refs\":%zu,\"hits\":%zu,\"misses\":%zu,\"clean_evictions\":%zu,"
+		"\"dirty_evictions\":%zu,\"resident\":%zu,\"swap_slots\":%zu}\n" :
+		"%zu,%zu,%zu,%zu,%zu,%zu,%zu\n";
+	buflen += snprintf(buf + buflen, INTERVAL_MAXREC, fmt, ref_count,
+	                   hit_count - last_hits, miss_count - last_misses,
+	                   evict_clean_count - last_clean,
+	                   evict_dirty_count - last_dirty,
+	                   resident_pages(), swap_slots_used);
+	last_refs = ref_count;
+	last_hits = hit_count;
+	last_misses = miss_count;
+	last_clean = evict_clean_count;
+	last_dirty = evict_dirty_count;
+	interval_next = ref_count + interval_length;
+}
+
+void interval_close(void)
+{
+	if (ref_count > last_refs) {
+		interval_record();
+	}
+	interval_flush();
+	if (interval_fd != STDOUT_FILENO) {
+		close(interval_fd);
+	}
+	free369(buf);
+}
+
+// Snapshots. Records up to the snapshot are flushed, so that a resumed run
+// can cut the file back to that point and carry on from there.
+void interval_save(void)
+{
+	if (interval_length > 0) {
+		interval_flush();
+	}
+	SNAP_WRITE(written);
+	SNAP_WRITE(interval_next);
+	SNAP_WRITE(last_refs);
+	SNAP_WRITE(last_hits);
+	SNAP_WRITE(last_misses);
+	SNAP_WRITE(last_clean);
+	SNAP_WRITE(last_dirty);
+}
+
+void interval_restore(void)
+{
+	off_t saved_written;
+	SNAP_READ(saved_written);
+	SNAP_READ(interval_next);
+	SNAP_READ(last_refs);
+	SNAP_READ(last_hits);
+	SNAP_READ(last_misses);
+	SNAP_READ(last_clean);
+	SNAP_READ(last_dirty);
+	if (interval_length > 0 && interval_fd != STDOUT_FILENO) {
+		if (ftruncate(interval_fd, saved_written) != 0) {
+			perror("interval_restore");
+		}
+		lseek(interval_fd, 0, SEEK_END);
+		written = saved_written;
+	}
+}
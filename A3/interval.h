@@ -0,0 +1,39 @@
+#ifndef __INTERVAL_H__
+#define __INTERVAL_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "sim.h"
+
+// Per-interval statistics. Every interval_length references, one record
+// is written with the hits, misses and evictions during the interval, and
+// the resident set size and swap usage at its end. Records are CSV lines
+// (with a header) or JSON lines. They are collected in a buffer and only
+// written out when it fills up, to keep I/O out of the timed section.
+
+// Configuration, set by sim.c. An interval of 0 disables the output.
+extern size_t interval_length;
+extern bool interval_json;
+
+// Open path for the records ("-" for stdout). When resuming from a
+// snapshot, the file is not truncated and no CSV header is written;
+// interval_restore() cuts it back to where the snapshot was taken.
+// Return: 0 on success, -1 if the file could not be opened.
+extern int interval_open(const char *path, bool resume);
+
+// Write out the last, partial interval and any buffered records, and
+// close the file.
+extern void interval_close(void);
+
+extern size_t interval_next; // ref_count at which the next record is due
+extern void interval_record(void);
+
+// Called from replay_trace after every reference.
+static inline void interval_tick(void)
+{
+	if (interval_length > 0 && ref_count >= interval_next) {
+		interval_record();
+	}
+}
+
+#endif /* __INTERVAL_H__ */
@@ -0,0 +1,229 @@
+#include <math.h>
+#include "malloc369.h"
+#include "sim.h"
+#include "coremap.h"
+#include "snapshot.h"
+
+double lrfu_lambda = 0.001;
+
+// Per frame, beside the coremap
+static double *lrfu_crf;    // Combined recency and frequency, as of last
+static double *lrfu_key;    // log2(crf) + lambda * last
+static size_t *lrfu_last;   // Time of the last reference
+static int *lrfu_pos;       // Index in the heap, or -1
+
+static int *heap;           // Frames, min-heap on key
+static int heap_len;
+static int *skipped;        // Frames set aside by lrfu_evict
+static size_t lrfu_time;    // References so far
+
+/* A page's CRF at time t is the sum, over its past references at times
+ * t_i, of F(t - t_i) = 2^(-lambda (t - t_i)). lambda = 0 counts
+ * references (LFU), and lambda = 1 makes the last reference outweigh all
+ * earlier ones (LRU). Every CRF decays at the same rate, so pages compare
+ * the same way at any time t as by log2(CRF(t)) + lambda t, which only
+ * changes when the page is referenced. That is the heap key.
+ */
+
+static void heap_set(int i, int frame)
+{
+    heap[i] = frame;
+    lrfu_pos[frame] = i;
+}
+
+static void sift_up(int i)
+{
+    int frame = heap[i];
+    while (i > 0 && lrfu_key[heap[(i - 1) / 2]] > lrfu_key[frame]) {
+        heap_set(i, heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    heap_set(i, frame);
+}
+
+static void sift_down(int i)
+{
+    int frame = heap[i];
+    while (2 * i + 1 < heap_len) {
+        int child = 2 * i + 1;
+        if (child + 1 < heap_len && lrfu_key[heap[child + 1]] < lrfu_key[heap[child]]) {
+            child++;
+        }
+        if (lrfu_key[heap[child]] >= lrfu_key[frame]) {
+            break;
+        }
+        heap_set(i, heap[child]);
+        i = child;
+    }
+    heap_set(i, frame);
+}
+
+static void heap_push(int frame)
+{
+    heap_set(heap_len++, frame);
+    sift_up(heap_len - 1);
+}
+
+static void heap_remove(int frame)
+{
+    int i = lrfu_pos[frame];
+    lrfu_pos[frame] = -1;
+    if (i == --heap_len) {
+        return;
+    }
+    // Put the last frame in the hole, then move it up or down
+    int moved = heap[heap_len];
+    heap_set(i, moved);
+    sift_up(i);
+    sift_down(lrfu_pos[moved]);
+}
+
+/* Page to evict is chosen using the LRFU algorithm: the page with the
+ * smallest CRF. Frames that can't be evicted right now are set aside and
+ * put back afterwards.
+ * Returns the page frame number (which is also the index in the coremap)
+ * for the page that is to be evicted.
+ */
+int lrfu_evict(void)
+{
+    int nskipped = 0;
+    int victim;
+    while (true) {
+        assert(heap_len > 0);
+        victim = heap[0];
+        heap_remove(victim);
+        if (evictable(victim)) {
+            break;
+        }
+        skipped[nskipped++] = victim;
+    }
+    for (int i = 0; i < nskipped; i++) {
+        heap_push(skipped[i]);
+    }
+    return victim;
+}
+
+/* This function is called on each access to a page to update any information
+ * needed by the LRFU algorithm.
+ * Input: The page table entry and full virtual address (not just VPN)
+ * for the page that is being accessed.
+ */
+void lrfu_ref(int frame, vaddr_t vaddr)
+{
+    (void)vaddr;
+    size_t now = lrfu_time++;
+    if (lrfu_pos[frame] < 0) {
+        lrfu_crf[frame] = 1.0;
+        lrfu_last[frame] = now;
+        lrfu_key[frame] = lrfu_lambda * now;
+        heap_push(frame);
+        return;
+    }
+    lrfu_crf[frame] = 1.0 + lrfu_crf[frame] * exp2(-lrfu_lambda * (now - lrfu_last[frame]));
+    lrfu_last[frame] = now;
+    // The key only grows
+    lrfu_key[frame] = log2(lrfu_crf[frame]) + lrfu_lambda * now;
+    sift_down(lrfu_pos[frame]);
+}
+
+/* This function is called when a page is read ahead into frame, before it
+ * is used. It takes the place of a page referenced once now, but with a
+ * CRF of 0, so its first use counts as its first reference.
+ */
+void lrfu_prefetch(int frame, vaddr_t vaddr)
+{
+    (void)vaddr;
+    lrfu_crf[frame] = 0.0;
+    lrfu_last[frame] = lrfu_time;
+    lrfu_key[frame] = lrfu_lambda * lrfu_time;
+    heap_push(frame);
+}
+
+/* This function is called when the page in frame is freed without being
+ * evicted, to drop any information the algorithm keeps about it.
+ */
+void lrfu_drop(int frame)
+{
+    if (lrfu_pos[frame] >= 0) {
+        heap_remove(frame);
+    }
+}
+
+/* This function is called when the pages in frames a and b trade places,
+ * where b may be free, to move any information the algorithm keeps about
+ * them. Their keys trade places too, so the heap stays in order.
+ */
+void lrfu_exchange(int a, int b)
+{
+    double crf = lrfu_crf[a];
+    lrfu_crf[a] = lrfu_crf[b];
+    lrfu_crf[b] = crf;
+    double key = lrfu_key[a];
+    lrfu_key[a] = lrfu_key[b];
+    lrfu_key[b] = key;
+    size_t last = lrfu_last[a];
+    lrfu_last[a] = lrfu_last[b];
+    lrfu_last[b] = last;
+
+    int pos_a = lrfu_pos[a];
+    int pos_b = lrfu_pos[b];
+    lrfu_pos[a] = pos_b;
+    lrfu_pos[b] = pos_a;
+    if (pos_a >= 0) {
+        heap[pos_a] = b;
+    }
+    if (pos_b >= 0) {
+        heap[pos_b] = a;
+    }
+}
+
+/* Save or restore the algorithm's state in a snapshot. */
+void lrfu_save(void)
+{
+    SNAP_WRITE(lrfu_time);
+    SNAP_WRITE(heap_len);
+    snap_write(heap, heap_len * sizeof(int));
+    snap_write(lrfu_crf, memsize * sizeof(double));
+    snap_write(lrfu_key, memsize * sizeof(double));
+    snap_write(lrfu_last, memsize * sizeof(size_t));
+}
+
+void lrfu_restore(void)
+{
+    SNAP_READ(lrfu_time);
+    SNAP_READ(heap_len);
+    snap_read(heap, heap_len * sizeof(int));
+    snap_read(lrfu_crf, memsize * sizeof(double));
+    snap_read(lrfu_key, memsize * sizeof(double));
+    snap_read(lrfu_last, memsize * sizeof(size_t));
+    for (int i = 0; i < heap_len; i++) {
+        lrfu_pos[heap[i]] = i;
+    }
+}
+
+/* Initialize any data structures needed for this replacement algorithm. */
+void lrfu_init(void)
+{
+    lrfu_crf = malloc369(memsize * sizeof(double));
+    lrfu_key = malloc369(memsize * sizeof(double));
+    lrfu_last = malloc369(memsize * sizeof(size_t));
+    lrfu_pos = malloc369(memsize * sizeof(int));
+    heap = malloc369(memsize * sizeof(int));
+    skipped = malloc369(memsize * sizeof(int));
+    for (size_t i = 0; i < memsize; i++) {
+        lrfu_pos[i] = -1;
+    }
+    heap_len = 0;
+    lrfu_time = 0;
+}
+
+/* Cleanup any data structures created in lrfu_init(). */
+void lrfu_cleanup(void)
+{
+    free369(lrfu_crf);
+    free369(lrfu_key);
+    free369(lrfu_last);
+    free369(lrfu_pos);
+    free369(heap);
+    free369(skipped);
+}
@@ -14,6 +14,7 @@
  */
 
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,6 +23,11 @@
 #include "coremap.h"
 #include "swap.h"
 #include "pagetable.h"
+#include "cleaner.h"
+#include "tlb.h"
+#include "tier.h"
+#include "cost.h"
+#include "snapshot.h"
 
 
 // Counters for various events.
@@ -31,10 +37,39 @@ size_t miss_count = 0;
 size_t ref_count = 0;
 size_t evict_clean_count = 0;
 size_t evict_dirty_count = 0;
+size_t dirty_frame_count = 0;
+size_t readahead_count = 0;
+size_t readahead_hit_count = 0;
+size_t shared_page_count = 0;
+size_t cow_fault_count = 0;
+size_t evict_mapping_count = 0;
+size_t evict_fanout_max = 0;
+size_t unmap_page_count = 0;
+size_t unmap_frame_count = 0;
+size_t unmap_swap_count = 0;
 
-// Define a Page Directory
+// Swap readahead window, in pages. 0 means no readahead or clustering.
+size_t readahead_window = 0;
+
+// Replacement scope. See sim.h
+bool local_replacement = false;
+size_t local_quota = 0;
+
+// Processes seen in the trace, indexed by ASID
+static process_t **processes;
+static size_t num_processes = 0;
+static size_t num_live = 0; // Processes that have not exited
+static process_t *current;
+
+// Page directory of the current process
 pt_directory_t *page_directory;
 
+// Number of frames pinned by an in-progress batched page-in
+static size_t pinned_count = 0;
+
+static off_t cluster_slot(pt_entry_t *pte);
+static process_t *new_process(int pid);
+
 // Accessor functions for page table entries, to allow replacement
 // algorithms to obtain information from a PTE, without depending
 // on the internal implementation of the structure.
@@ -63,22 +98,173 @@ void set_referenced(pt_entry_t *pte, bool val)
 	pte->referenced = val;
 }
 
+/* Returns the virtual page number of the page mapped by pte */
+vaddr_t get_vpn(pt_entry_t *pte)
+{
+	return pte->vpn;
+}
+
 /*
  * Initializes your page table.
  * This function is called once at the start of the simulation.
- * For the simulation, there is a single "process" whose reference trace is
- * being simulated, so there is just one overall page table.
- *
- * In a real OS, each process would have its own page table, which would
- * need to be allocated and initialized as part of process creation.
+ * Each process in the trace gets its own page table, allocated when the
+ * process is first seen. References before any process marker belong to
+ * pid 0.
  * 
  * The format of the page table, and thus what you need to do to get ready
  * to start translating virtual addresses, is up to you. 
  */
 void init_pagetable(void)
 {
-    page_directory = malloc369(sizeof(pt_directory_t));
-    memset(page_directory, 0, sizeof(pt_directory_t));
+    processes = NULL;
+    num_processes = 0;
+    num_live = 0;
+    current = new_process(0); // Traces without process markers belong to pid 0
+    page_directory = current->page_directory;
+    if (tlb_entries > 0) {
+        tlb_init();
+    }
+}
+
+static process_t *find_process(int pid)
+{
+    // Processes are few and switches are rare, so a linear search will do
+    for (size_t i = 0; i < num_processes; i++) {
+        if (processes[i]->pid == pid) {
+            return processes[i];
+        }
+    }
+    return NULL;
+}
+
+/* Creates process pid, with the next free ASID and an empty page table */
+static process_t *new_process(int pid)
+{
+    if (num_processes == MAX_ASIDS) {
+        fprintf(stderr, "Too many processes in trace (max %d)\n", MAX_ASIDS);
+        exit(1);
+    }
+    process_t **grown = malloc369((num_processes + 1) * sizeof(process_t *));
+    if (num_processes > 0) {
+        memcpy(grown, processes, num_processes * sizeof(process_t *));
+        free369(processes);
+    }
+    processes = grown;
+
+    process_t *p = malloc369(sizeof(process_t));
+    memset(p, 0, sizeof(process_t));
+    p->pid = pid;
+    p->asid = num_processes;
+    p->page_directory = malloc369(sizeof(pt_directory_t));
+    memset(p->page_directory, 0, sizeof(pt_directory_t));
+    processes[num_processes++] = p;
+    num_live++;
+    return p;
+}
+
+/*
+ * Makes pid the current process, creating it with an empty page table if it
+ * has not been seen before. Called from replay_trace() for 'P' records.
+ */
+void switch_process(int pid)
+{
+    process_t *p = find_process(pid);
+    if (p) {
+        if (p->exited) { // The pid is being reused
+            p->exited = false;
+            num_live++;
+        }
+        current = p;
+        page_directory = current->page_directory;
+        return;
+    }
+
+    // Traces that start with a process marker never use the initial pid 0
+    if (num_processes == 1 && current->ref_count == 0) {
+        current->pid = pid;
+        return;
+    }
+
+    current = new_process(pid);
+    page_directory = current->page_directory;
+}
+
+/*
+ * Returns the ASID that the next eviction must take its victim from, or -1
+ * if any frame will do. With local replacement, a process that has used up
+ * its share of memory replaces its own pages, as long as it has one that is
+ * not pinned.
+ */
+int victim_asid(void)
+{
+    if (!local_replacement) {
+        return -1;
+    }
+    size_t quota = local_quota;
+    if (quota == 0) {
+        quota = memsize / (num_live ? num_live : 1);
+    }
+    if (current->resident >= quota && current->resident > pinned_count) {
+        return current->asid;
+    }
+    return -1;
+}
+
+/*
+ * Allocates a frame for the page represented by pte, and charges it to the
+ * process that owns the page.
+ */
+static unsigned int page_frame(pt_entry_t *pte)
+{
+    int frame = allocate_frame(pte);
+    coremap[frame].asid = pte->asid;
+    processes[pte->asid]->resident++;
+    return frame;
+}
+
+/* Returns true if other page table entries map the same page as pte */
+static inline bool is_shared(pt_entry_t *pte)
+{
+    return pte->rmap_next != pte;
+}
+
+/*
+ * Copies the state of the page mapped by pte to every other entry that
+ * maps the same page.
+ */
+static void sync_mappings(pt_entry_t *pte)
+{
+    for (pt_entry_t *m = pte->rmap_next; m != pte; m = m->rmap_next) {
+        m->frame_number = pte->frame_number;
+        m->swap_offset = pte->swap_offset;
+        m->valid = pte->valid;
+        m->dirty = pte->dirty;
+        m->cleaned = pte->cleaned;
+    }
+}
+
+/*
+ * Removes pte from the reverse map of its page. If the page is resident and
+ * its frame points back to pte, the frame is handed over to another entry
+ * (and the process that owns it).
+ */
+static void unlink_mapping(pt_entry_t *pte)
+{
+    pt_entry_t *prev = pte;
+    while (prev->rmap_next != pte) {
+        prev = prev->rmap_next;
+    }
+    prev->rmap_next = pte->rmap_next;
+    pte->rmap_next = pte;
+
+    struct frame *f = &coremap[pte->frame_number];
+    if (pte->valid && f->pte == pte) {
+        processes[f->asid]->resident--;
+        f->pte = prev;
+        f->asid = prev->asid;
+        processes[prev->asid]->resident++;
+        prev->referenced = pte->referenced;
+    }
 }
 
 /*
@@ -92,20 +278,120 @@ void init_pagetable(void)
  */
 void handle_evict(pt_entry_t * pte)
 {
+    if (pte->cleaned) {
+        // The cleaner already wrote this page out, saving us a write here
+        cleaned_evict_count++;
+        pte->cleaned = false;
+    }
     if (pte->dirty) {
         evict_dirty_count ++;
-        pte->swap_offset = swap_pageout(pte->frame_number, pte->swap_offset);
+        dirty_frame_count --;
+        if (pte->swap_offset == INVALID_SWAP && readahead_window > 0) {
+            pte->swap_offset = cluster_slot(pte);
+        }
+        unsigned place;
+        pte->swap_offset = swap_pageout(pte->frame_number, pte->swap_offset, &place);
+        if (place & SWAP_DEVICE) {
+            simulated_ns += cost_model.swap_write;
+        }
+        if (place & SWAP_POOL) {
+            simulated_ns += cost_model.pool;
+        }
     } else {
         evict_clean_count ++;
     }
     pte->valid = false;
+    pte->readahead = false;
+    processes[pte->asid]->resident--;
+    sync_mappings(pte);
+
+    // Every mapping of the page has to go, not just the one in the coremap
+    size_t fanout = 0;
+    pt_entry_t *m = pte;
+    do {
+        if (tlb_entries > 0) {
+            tlb_invalidate(m->asid, m->vpn);
+        }
+        fanout++;
+        m = m->rmap_next;
+    } while (m != pte);
+    evict_mapping_count += fanout;
+    if (fanout > evict_fanout_max) {
+        evict_fanout_max = fanout;
+    }
+}
+
+/*
+ * Moves the page in frame a to frame b, and the page in frame b, if there is
+ * one, to frame a. Both pages stay resident, with the same page table
+ * entries, so cached translations stay valid.
+ *
+ * Called from tier.c to migrate pages between memory tiers. The
+ * replacement algorithm moves what it knows about each page to its new
+ * frame, so a migration doesn't count as a reference.
+ */
+void exchange_frames(int a, int b)
+{
+    struct frame *fa = &coremap[a];
+    struct frame *fb = &coremap[b];
+    assert(fa->in_use && !fa->pinned && !fb->pinned);
+    exchange_func(a, b);
+
+    unsigned char tmp[MAX_SIMPAGESIZE];
+    memcpy(tmp, &physmem[a * simpagesize], simpagesize);
+    memcpy(&physmem[a * simpagesize], &physmem[b * simpagesize], simpagesize);
+    memcpy(&physmem[b * simpagesize], tmp, simpagesize);
+
+    struct frame moved = *fa;
+    fa->in_use = fb->in_use;
+    fa->asid = fb->asid;
+    fa->pte = fb->pte;
+    fb->in_use = moved.in_use;
+    fb->asid = moved.asid;
+    fb->pte = moved.pte;
+
+    if (fa->in_use) {
+        fa->pte->frame_number = a;
+        sync_mappings(fa->pte);
+    }
+    fb->pte->frame_number = b;
+    sync_mappings(fb->pte);
 }
 
 /*
- * Looks up the PTE by indexing using the vaddr.
+ * Write the dirty, resident page represented by pte to swap ahead of time
+ * and mark it clean, so that evicting it later does not need a swap write.
+ * Returns false if the page could not be written, leaving it dirty, with
+ * its swap slot as it was, for eviction to write out.
+ *
+ * Called from the background page cleaner in cleaner.c.
+ */
+bool handle_clean(pt_entry_t *pte)
+{
+    assert(pte->valid && pte->dirty);
+    if (pte->swap_offset == INVALID_SWAP && readahead_window > 0) {
+        pte->swap_offset = cluster_slot(pte);
+    }
+    off_t offset = swap_pageout(pte->frame_number, pte->swap_offset, NULL);
+    if (offset == INVALID_SWAP) {
+        return false;
+    }
+    pte->swap_offset = offset;
+    pte->dirty = false;
+    pte->cleaned = true;
+    dirty_frame_count--;
+    sync_mappings(pte);
+    return true;
+}
+
+/*
+ * Looks up the PTE by indexing into proc's page table using the vaddr.
  * Allocate new page tables & initialize the entry if the entry does not already exist.
  */
-pt_entry_t *pagetable_lookup(vaddr_t vaddr){
+static pt_entry_t *pagetable_walk(process_t *proc, vaddr_t vaddr)
+{
+    pt_directory_t *page_directory = proc->page_directory;
+
     // Calculate the indexes for the multi-level page table by shifting and looking at the rightmost 9 bits.
     size_t directory_index = (vaddr >>39) & 0x1FF;
     size_t top_index = (vaddr >> 30) & 0x1FF;
@@ -139,11 +425,207 @@ pt_entry_t *pagetable_lookup(vaddr_t vaddr){
         entry = bot->entries[bottom_index];
         memset(entry, 0, sizeof(pt_entry_t)); // Initialize everything to 0 or NULL
         entry->swap_offset = INVALID_SWAP; // This is the only thing initialized to -1
+        entry->vpn = vaddr >> PAGE_SHIFT;
+        entry->asid = proc->asid;
+        entry->rmap_next = entry;
     }
 
     return entry;
 }
 
+/*
+ * Looks up the PTE for vaddr in the current process, allocating it if needed.
+ */
+pt_entry_t *pagetable_lookup(vaddr_t vaddr)
+{
+    return pagetable_walk(current, vaddr);
+}
+
+/*
+ * Looks up the PTE by indexing using the vaddr, like pagetable_lookup, but
+ * without allocating anything. Returns NULL if there is no entry yet.
+ */
+static pt_entry_t *pagetable_find(pt_directory_t *directory, vaddr_t vaddr)
+{
+    pt_top_t *top = directory->entries[(vaddr >> 39) & 0x1FF];
+    if (!top) {
+        return NULL;
+    }
+    pt_middle_t *mid = top->entries[(vaddr >> 30) & 0x1FF];
+    if (!mid) {
+        return NULL;
+    }
+    pt_bottom_t *bot = mid->entries[(vaddr >> 21) & 0x1FF];
+    if (!bot) {
+        return NULL;
+    }
+    return bot->entries[(vaddr >> 12) & 0x1FF];
+}
+
+/*
+ * Returns the PTE for the page 'delta' pages away from pte, or NULL if
+ * there is none. Readahead and clustering only look at neighbours covered
+ * by the same bottom level page table.
+ */
+static pt_entry_t *neighbour(pt_entry_t *pte, long delta)
+{
+    vaddr_t vpn = pte->vpn + delta;
+    if ((vpn / NUM_ENTRIES) != (pte->vpn / NUM_ENTRIES)) {
+        return NULL;
+    }
+    return pagetable_find(processes[pte->asid]->page_directory, vpn << PAGE_SHIFT);
+}
+
+/*
+ * Picks a swap slot for a page being evicted so that it lands next to the
+ * slots of its virtual neighbours, which lets readahead bring them back in
+ * with one read. Returns INVALID_SWAP if no such slot is free.
+ */
+static off_t cluster_slot(pt_entry_t *pte)
+{
+    for (long d = 1; d <= (long)readahead_window; d++) {
+        for (long delta = -d; delta <= d; delta += 2 * d) {
+            pt_entry_t *n = neighbour(pte, delta);
+            if (n && n->swap_offset != INVALID_SWAP) {
+                off_t offset = swap_reserve(n->swap_offset - delta * (off_t)simpagesize);
+                if (offset != INVALID_SWAP) {
+                    return offset;
+                }
+            }
+        }
+    }
+    return INVALID_SWAP;
+}
+
+/*
+ * Charges a pagein for the places swap found its pages: a device read,
+ * decompressing from the pool, or nothing beyond a copy for a page still in
+ * the writeback queue.
+ */
+static void charge_pagein(unsigned place)
+{
+    if (place & SWAP_DEVICE) {
+        simulated_ns += cost_model.swap_read;
+    }
+    if (place & SWAP_POOL) {
+        simulated_ns += cost_model.pool;
+    }
+}
+
+/*
+ * Brings the page for entry in from swap, along with any of its non-resident
+ * virtual neighbours (up to readahead_window pages away on either side) that
+ * are stored in the adjacent swap slots. All of the pages are read with a
+ * single batched read. The neighbours are resident but unreferenced
+ * afterwards, and the replacement algorithm hears about them as pages read
+ * ahead rather than referenced. If the read fails, only the faulting page
+ * is brought in.
+ */
+static void swapin_cluster(pt_entry_t *entry)
+{
+    // Never pin more than half of memory, so there is always a victim
+    long window = readahead_window;
+    if (window > (long)memsize / 4) {
+        window = memsize / 4;
+    }
+    if (window > IOV_MAX / 2 - 1) {
+        window = IOV_MAX / 2 - 1;
+    }
+
+    // Extend the run backwards, then forwards, over adjacent slots
+    long before = 0;
+    long after = 0;
+    pt_entry_t *n;
+    // Shared pages are left out, since their other mappings would need
+    // updating too.
+    while (before < window && (n = neighbour(entry, -(before + 1))) &&
+           !n->valid && !is_shared(n) && n->swap_offset == entry->swap_offset - (before + 1) * (off_t)simpagesize) {
+        before++;
+    }
+    while (after < window && (n = neighbour(entry, after + 1)) &&
+           !n->valid && !is_shared(n) && n->swap_offset == entry->swap_offset + (after + 1) * (off_t)simpagesize) {
+        after++;
+    }
+
+    // Allocate frames for the whole run, faulting page first, pinning them
+    // so that allocating one cannot evict another.
+    int count = before + 1 + after;
+    pt_entry_t *run[count];
+    unsigned int frames[count];
+    for (int i = 0; i < count; i++) {
+        int idx = (i == 0) ? before : (i <= before ? i - 1 : i);
+        run[idx] = neighbour(entry, idx - before);
+        run[idx]->frame_number = page_frame(run[idx]);
+        run[idx]->valid = 1;
+        run[idx]->dirty = 0; // If we are doing pagein, it should be clean at first
+        coremap[run[idx]->frame_number].pinned = true;
+        pinned_count++;
+        frames[idx] = run[idx]->frame_number;
+    }
+
+    unsigned place;
+    int ret = swap_pagein_batch(frames, count, run[0]->swap_offset, &place);
+    pinned_count -= count;
+    for (int i = 0; i < count; i++) {
+        coremap[frames[i]].pinned = false;
+    }
+    if (ret != 0) {
+        // Give the neighbours' frames back and read just the faulting page
+        for (int i = 0; i < count; i++) {
+            if (run[i] != entry) {
+                run[i]->valid = 0;
+                processes[run[i]->asid]->resident--;
+                free_frame(frames[i]);
+            }
+        }
+        swap_pagein(entry->frame_number, entry->swap_offset, &place);
+        charge_pagein(place);
+        return;
+    }
+    charge_pagein(place);
+
+    for (int i = 0; i < count; i++) {
+        if (run[i] != entry) {
+            // Let the replacement algorithm know about the page, without
+            // counting it as a reference until it is actually used.
+            set_referenced(run[i], false);
+            prefetch_func(frames[i], (vaddr_t)run[i]->vpn << PAGE_SHIFT);
+            run[i]->readahead = 1;
+            readahead_count++;
+        }
+    }
+}
+
+
+/*
+ * Gives the resident, copy-on-write page mapped by entry a private copy
+ * that can be written. The shared page, and its swap slot, stay with the
+ * other mappings.
+ */
+static void cow_copy(pt_entry_t *entry)
+{
+    unsigned int src = entry->frame_number;
+    unlink_mapping(entry);
+
+    // The copy reads the shared page, which may have just been faulted in,
+    // so the replacement algorithm needs to hear about it.
+    ref_func(src, (vaddr_t)entry->vpn << PAGE_SHIFT);
+
+    // Keep the source from being evicted while we allocate its copy
+    coremap[src].pinned = true;
+    pinned_count++;
+    entry->frame_number = page_frame(entry);
+    coremap[src].pinned = false;
+    pinned_count--;
+
+    memcpy(&physmem[entry->frame_number * simpagesize],
+           &physmem[src * simpagesize], simpagesize);
+    entry->swap_offset = INVALID_SWAP;
+    entry->dirty = 0;
+    entry->cleaned = 0;
+    cow_fault_count++;
+    simulated_ns += cost_model.zero_fill;
+}
 
 /*
  * Locate the physical frame number for the given vaddr using the page table.
@@ -172,30 +654,540 @@ pt_entry_t *pagetable_lookup(vaddr_t vaddr){
 int find_frame_number(vaddr_t vaddr, char type)
 {
     ref_count ++;
-    pt_entry_t *entry = pagetable_lookup(vaddr);
+    current->ref_count++;
+    cleaner_tick();
+    tier_tick();
+
+    // A TLB hit means the page is resident, and skips the page table walk
+    pt_entry_t *entry = NULL;
+    if (tlb_entries > 0) {
+        entry = tlb_lookup(current->asid, vaddr >> PAGE_SHIFT);
+    }
+    bool tlb_miss = (entry == NULL);
+    if (tlb_miss) {
+        entry = pagetable_lookup(vaddr);
+        if (tlb_entries > 0) {
+            simulated_ns += cost_model.tlb_miss;
+        }
+    }
+    if (num_tiers == 0) {
+        simulated_ns += cost_model.hit;
+    }
+
     if (!entry->valid) {
         miss_count++;
-        entry->frame_number = allocate_frame(entry);
-        entry->valid = 1;
-        if (entry->swap_offset == INVALID_SWAP) {
-            init_frame(entry->frame_number);
-            entry->dirty = 1; // First reference
+        current->miss_count++;
+        if (entry->swap_offset != INVALID_SWAP && readahead_window > 0) {
+            swapin_cluster(entry);
         } else {
-            swap_pagein(entry->frame_number, entry->swap_offset);
-            entry->dirty = 0; // If we are doing pagein, it should be clean at first
+            entry->frame_number = page_frame(entry);
+            entry->valid = 1;
+            if (entry->swap_offset == INVALID_SWAP) {
+                init_frame(entry->frame_number);
+                simulated_ns += cost_model.zero_fill;
+                entry->dirty = 1; // First reference
+                dirty_frame_count++;
+            } else {
+                unsigned place;
+                swap_pagein(entry->frame_number, entry->swap_offset, &place);
+                charge_pagein(place);
+                entry->dirty = 0; // If we are doing pagein, it should be clean at first
+            }
         }
+        // One fault brings the page in for every process that maps it
+        sync_mappings(entry);
     } else {
         hit_count++;
+        current->hit_count++;
+        if (entry->readahead) {
+            readahead_hit_count++;
+            entry->readahead = 0;
+        }
     }
 
     if ((type == 'S') || (type == 'M')) {
+        if (is_shared(entry) && !entry->shared) {
+            cow_copy(entry);
+        }
+        if (!entry->dirty) {
+            dirty_frame_count++;
+        }
+        if (entry->cleaned) {
+            // The cleaner wrote this page out for nothing
+            cleaned_wasted_count++;
+            entry->cleaned = 0;
+        }
         entry->dirty = 1; // Because we have modified it
+        if (entry->swap_offset != INVALID_SWAP) {
+            // The copy on swap is stale now, so give its slot back.
+            swap_free(entry->swap_offset);
+            entry->swap_offset = INVALID_SWAP;
+        }
+        sync_mappings(entry);
     }
 
+    if (tlb_miss && tlb_entries > 0) {
+        tlb_insert(current->asid, entry->vpn, entry);
+    }
+    if (num_tiers > 0) {
+        tier_access(entry->frame_number);
+    }
     return entry->frame_number;
 }
 
-void print_pagetable(void)
+/*
+ * Throws away the page mapped by pte, freeing its frame and swap slot unless
+ * other entries still map it. The entry itself is left for the caller.
+ */
+static void drop_page(pt_entry_t *pte)
+{
+    if (tlb_entries > 0) {
+        tlb_invalidate(pte->asid, pte->vpn);
+    }
+    if (is_shared(pte)) {
+        unlink_mapping(pte);
+    } else {
+        if (pte->valid) {
+            if (pte->dirty) {
+                dirty_frame_count--;
+            }
+            processes[pte->asid]->resident--;
+            free_frame(pte->frame_number);
+        }
+        if (pte->swap_offset != INVALID_SWAP) {
+            swap_free(pte->swap_offset);
+        }
+    }
+    memset(pte, 0, sizeof(pt_entry_t));
+    pte->swap_offset = INVALID_SWAP;
+    pte->rmap_next = pte;
+}
+
+/*
+ * Calls fn on every entry in a page table.
+ */
+static void for_each_entry(pt_directory_t *dir, void (*fn)(pt_entry_t *, void *), void *arg)
+{
+    for (int i = 0; i < NUM_ENTRIES; i++) {
+        pt_top_t *top = dir->entries[i];
+        for (int j = 0; top && j < NUM_ENTRIES; j++) {
+            pt_middle_t *mid = top->entries[j];
+            for (int k = 0; mid && k < NUM_ENTRIES; k++) {
+                pt_bottom_t *bot = mid->entries[k];
+                for (int l = 0; bot && l < NUM_ENTRIES; l++) {
+                    if (bot->entries[l]) {
+                        fn(bot->entries[l], arg);
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void free_directory(pt_directory_t *page_directory);
+
+static void drop_entry(pt_entry_t *pte, void *arg)
+{
+    (void)arg;
+    drop_page(pte);
+}
+
+/* Throws away all of the pages of p, leaving it with an empty page table */
+static void clear_address_space(process_t *p)
+{
+    for_each_entry(p->page_directory, drop_entry, NULL);
+    free_directory(p->page_directory);
+    p->page_directory = malloc369(sizeof(pt_directory_t));
+    memset(p->page_directory, 0, sizeof(pt_directory_t));
+}
+
+/*
+ * Ends the current process: all of its pages are thrown away and its page
+ * table is emptied. Called from replay_trace() for 'X' records.
+ */
+void exit_process(void)
+{
+    clear_address_space(current);
+    page_directory = current->page_directory;
+    if (!current->exited) {
+        current->exited = true;
+        num_live--;
+    }
+}
+
+static void fork_entry(pt_entry_t *pe, void *arg)
+{
+    if (!pe->valid && pe->swap_offset == INVALID_SWAP) {
+        return; // Nothing to share
+    }
+    pt_entry_t *ce = pagetable_walk(arg, (vaddr_t)pe->vpn << PAGE_SHIFT);
+    ce->frame_number = pe->frame_number;
+    ce->swap_offset = pe->swap_offset;
+    ce->valid = pe->valid;
+    ce->dirty = pe->dirty;
+    ce->cleaned = pe->cleaned;
+    ce->shared = pe->shared;
+    ce->rmap_next = pe->rmap_next;
+    pe->rmap_next = ce;
+    shared_page_count++;
+}
+
+/*
+ * Forks the current process. The child, child_pid, gets a copy of the
+ * parent's address space that shares all of its pages copy-on-write (and
+ * shared mappings as they are). The parent stays the current process.
+ * Called from replay_trace() for 'F' records.
+ */
+void fork_process(int child_pid)
+{
+    process_t *parent = current;
+    switch_process(child_pid);
+    process_t *child = current;
+    if (child != parent) {
+        clear_address_space(child); // In case the pid is being reused
+        for_each_entry(parent->page_directory, fork_entry, child);
+    }
+    current = parent;
+    page_directory = current->page_directory;
+}
+
+/*
+ * Maps npages pages starting at vaddr in process src_pid into the current
+ * process at the same addresses, as a shared mapping: writes by either
+ * process are seen by the other. Anything the current process had mapped
+ * there is thrown away. Called from replay_trace() for 'A' records.
+ * Returns 0 on success, or -1 if src_pid does not exist or one of the
+ * pages is copy-on-write.
+ */
+int attach_pages(int src_pid, vaddr_t vaddr, size_t npages)
+{
+    process_t *src = find_process(src_pid);
+    if (!src) {
+        return -1;
+    }
+    for (size_t i = 0; i < npages; i++) {
+        vaddr_t va = (vaddr & PAGE_MASK) + i * PAGE_SIZE;
+        pt_entry_t *spte = pagetable_walk(src, va);
+        pt_entry_t *dpte = pagetable_walk(current, va);
+        if (is_shared(spte) && !spte->shared) {
+            return -1;
+        }
+
+        bool mapped = (dpte == spte);
+        for (pt_entry_t *m = spte->rmap_next; m != spte; m = m->rmap_next) {
+            mapped = mapped || (m == dpte);
+        }
+        if (mapped) {
+            continue;
+        }
+
+        drop_page(dpte);
+        dpte->vpn = va >> PAGE_SHIFT;
+        dpte->asid = current->asid;
+        spte->shared = true;
+        dpte->shared = true;
+        dpte->rmap_next = spte->rmap_next;
+        spte->rmap_next = dpte;
+        sync_mappings(spte);
+        shared_page_count++;
+    }
+    return 0;
+}
+
+/*
+ * Unmaps npages pages starting at vaddr in the current process. Their pages
+ * are thrown away, freeing the frames and swap slots that no other entry
+ * maps, and their entries are freed, along with bottom level page tables
+ * that end up empty. Page tables that don't exist are skipped whole, so the
+ * work done depends on the page tables in the range, not on its size.
+ * Called from replay_trace() for 'U' records.
+ * Returns 0 on success, or -1 if the range goes past the top of the
+ * address space.
+ */
+int unmap_pages(vaddr_t vaddr, size_t npages)
+{
+    const vaddr_t top_span = 1UL << 39;
+    const vaddr_t mid_span = 1UL << 30;
+    const vaddr_t bot_span = 1UL << 21;
+    vaddr_t va = vaddr & PAGE_MASK;
+    if (va >= 1UL << 48 || npages > ((1UL << 48) - va) / PAGE_SIZE) {
+        return -1;
+    }
+    vaddr_t end = va + npages * PAGE_SIZE;
+
+    while (va < end) {
+        pt_top_t *top = page_directory->entries[(va >> 39) & 0x1FF];
+        if (!top) {
+            va = (va & ~(top_span - 1)) + top_span;
+            continue;
+        }
+        pt_middle_t *mid = top->entries[(va >> 30) & 0x1FF];
+        if (!mid) {
+            va = (va & ~(mid_span - 1)) + mid_span;
+            continue;
+        }
+        pt_bottom_t **botp = &mid->entries[(va >> 21) & 0x1FF];
+        pt_bottom_t *bot = *botp;
+        vaddr_t bot_end = (va & ~(bot_span - 1)) + bot_span;
+        if (!bot) {
+            va = bot_end;
+            continue;
+        }
+
+        for (; va < end && va < bot_end; va += PAGE_SIZE) {
+            pt_entry_t **slot = &bot->entries[(va >> 12) & 0x1FF];
+            pt_entry_t *pte = *slot;
+            if (!pte) {
+                continue;
+            }
+            unmap_page_count++;
+            if (!is_shared(pte)) {
+                unmap_frame_count += pte->valid;
+                unmap_swap_count += (pte->swap_offset != INVALID_SWAP);
+            }
+            drop_page(pte);
+            free369(pte);
+            *slot = NULL;
+        }
+
+        bool empty = true;
+        for (int i = 0; i < NUM_ENTRIES && empty; i++) {
+            empty = (bot->entries[i] == NULL);
+        }
+        if (empty) {
+            free369(bot);
+            *botp = NULL;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Returns the number of frames that sharing currently saves, i.e. how many
+ * more frames would be needed if every resident mapping had its own copy.
+ */
+size_t pages_saved_by_sharing(void)
+{
+    size_t saved = 0;
+    for (size_t f = 0; f < memsize; f++) {
+        if (coremap[f].in_use) {
+            pt_entry_t *pte = coremap[f].pte;
+            for (pt_entry_t *m = pte->rmap_next; m != pte; m = m->rmap_next) {
+                saved++;
+            }
+        }
+    }
+    return saved;
+}
+
+/* Returns the number of frames holding pages, across all processes */
+size_t resident_pages(void)
+{
+    size_t resident = 0;
+    for (size_t i = 0; i < num_processes; i++) {
+        resident += processes[i]->resident;
+    }
+    return resident;
+}
+
+/* Prints per-process counters, if the trace had more than one process */
+void print_process_stats(void)
+{
+    if (num_processes < 2) {
+        return;
+    }
+    printf("\n");
+    printf("Processes: %zu\n", num_processes);
+    print_process_lines(stdout);
+}
+
+/*
+ * Writes one line of statistics per process to f. Used by
+ * print_process_stats(), and by sharded workers to hand their processes'
+ * statistics to the parent.
+ */
+void print_process_lines(FILE *f)
+{
+    for (size_t i = 0; i < num_processes; i++) {
+        process_t *p = processes[i];
+        double hit_rate = p->ref_count ? ((double)p->hit_count / p->ref_count) * 100.0 : 0.0;
+        fprintf(f, "  pid %d: %zu refs, %zu hits, %zu misses, hit rate %.4f, %zu resident%s\n",
+                p->pid, p->ref_count, p->hit_count, p->miss_count, hit_rate, p->resident,
+                p->exited ? " (exited)" : "");
+    }
+}
+
+/*
+ * Snapshots. Each process is saved with its counters and its page table
+ * entries, in page table order. Pointers between entries (the reverse map
+ * and the coremap's back pointers) are saved as (asid, vpn) pairs, and are
+ * rebuilt once every entry has been restored.
+ */
+struct entry_ref {
+    uint64_t asid;
+    uint64_t vpn;
+};
+
+pt_entry_t *pagetable_entry(unsigned int asid, vaddr_t vpn)
+{
+    if (asid >= num_processes) {
+        return NULL;
+    }
+    return pagetable_find(processes[asid]->page_directory, vpn << PAGE_SHIFT);
+}
+
+static void save_ref(pt_entry_t *pte)
+{
+    struct entry_ref ref = { pte->asid, pte->vpn };
+    SNAP_WRITE(ref);
+}
+
+static pt_entry_t *restore_ref(void)
+{
+    struct entry_ref ref;
+    SNAP_READ(ref);
+    pt_entry_t *pte = pagetable_entry(ref.asid, ref.vpn);
+    if (!pte) {
+        fprintf(stderr, "Snapshot refers to a missing page table entry\n");
+        exit(1);
+    }
+    return pte;
+}
+
+static void count_entry(pt_entry_t *pte, void *arg)
+{
+    (void)pte;
+    (*(size_t *)arg)++;
+}
+
+static void save_entry(pt_entry_t *pte, void *arg)
+{
+    (void)arg;
+    snap_write(pte, sizeof(pt_entry_t));
+}
+
+static void save_link(pt_entry_t *pte, void *arg)
+{
+    (void)arg;
+    save_ref(pte->rmap_next);
+}
+
+static void restore_link(pt_entry_t *pte, void *arg)
+{
+    (void)arg;
+    pte->rmap_next = restore_ref();
+}
+
+void pagetable_save(void)
+{
+    SNAP_WRITE(hit_count);
+    SNAP_WRITE(miss_count);
+    SNAP_WRITE(ref_count);
+    SNAP_WRITE(evict_clean_count);
+    SNAP_WRITE(evict_dirty_count);
+    SNAP_WRITE(dirty_frame_count);
+    SNAP_WRITE(readahead_count);
+    SNAP_WRITE(readahead_hit_count);
+    SNAP_WRITE(shared_page_count);
+    SNAP_WRITE(cow_fault_count);
+    SNAP_WRITE(evict_mapping_count);
+    SNAP_WRITE(evict_fanout_max);
+    SNAP_WRITE(unmap_page_count);
+    SNAP_WRITE(unmap_frame_count);
+    SNAP_WRITE(unmap_swap_count);
+
+    SNAP_WRITE(num_processes);
+    for (size_t i = 0; i < num_processes; i++) {
+        process_t *p = processes[i];
+        size_t count = 0;
+        for_each_entry(p->page_directory, count_entry, &count);
+        SNAP_WRITE(p->pid);
+        SNAP_WRITE(p->ref_count);
+        SNAP_WRITE(p->hit_count);
+        SNAP_WRITE(p->miss_count);
+        SNAP_WRITE(p->resident);
+        SNAP_WRITE(p->exited);
+        SNAP_WRITE(count);
+        for_each_entry(p->page_directory, save_entry, NULL);
+    }
+    for (size_t i = 0; i < num_processes; i++) {
+        for_each_entry(processes[i]->page_directory, save_link, NULL);
+    }
+    SNAP_WRITE(num_live);
+    SNAP_WRITE(current->asid);
+
+    for (size_t f = 0; f < memsize; f++) {
+        SNAP_WRITE(coremap[f].in_use);
+        if (coremap[f].in_use) {
+            SNAP_WRITE(coremap[f].asid);
+            save_ref(coremap[f].pte);
+        }
+    }
+}
+
+/*
+ * Restores the page tables into the freshly initialized state left by
+ * init_pagetable(). Processes are recreated in ASID order, so they get the
+ * same ASIDs as before.
+ */
+void pagetable_restore(void)
+{
+    SNAP_READ(hit_count);
+    SNAP_READ(miss_count);
+    SNAP_READ(ref_count);
+    SNAP_READ(evict_clean_count);
+    SNAP_READ(evict_dirty_count);
+    SNAP_READ(dirty_frame_count);
+    SNAP_READ(readahead_count);
+    SNAP_READ(readahead_hit_count);
+    SNAP_READ(shared_page_count);
+    SNAP_READ(cow_fault_count);
+    SNAP_READ(evict_mapping_count);
+    SNAP_READ(evict_fanout_max);
+    SNAP_READ(unmap_page_count);
+    SNAP_READ(unmap_frame_count);
+    SNAP_READ(unmap_swap_count);
+
+    size_t count;
+    SNAP_READ(count);
+    assert(num_processes == 1);
+    for (size_t i = 0; i < count; i++) {
+        process_t *p = (i == 0) ? processes[0] : new_process(0);
+        SNAP_READ(p->pid);
+        SNAP_READ(p->ref_count);
+        SNAP_READ(p->hit_count);
+        SNAP_READ(p->miss_count);
+        SNAP_READ(p->resident);
+        SNAP_READ(p->exited);
+
+        size_t entries;
+        SNAP_READ(entries);
+        for (size_t j = 0; j < entries; j++) {
+            pt_entry_t saved;
+            snap_read(&saved, sizeof(pt_entry_t));
+            pt_entry_t *pte = pagetable_walk(p, (vaddr_t)saved.vpn << PAGE_SHIFT);
+            *pte = saved;
+        }
+    }
+    for (size_t i = 0; i < num_processes; i++) {
+        for_each_entry(processes[i]->page_directory, restore_link, NULL);
+    }
+    unsigned int asid;
+    SNAP_READ(num_live);
+    SNAP_READ(asid);
+    current = processes[asid];
+    page_directory = current->page_directory;
+
+    for (size_t f = 0; f < memsize; f++) {
+        SNAP_READ(coremap[f].in_use);
+        if (coremap[f].in_use) {
+            SNAP_READ(coremap[f].asid);
+            coremap[f].pte = restore_ref();
+        }
+    }
+}
+
+static void print_directory(pt_directory_t *page_directory)
 {
     // WHY DO YOU HAVE TO MAKE ME DO THIS... I HATE MYSELF ENOUGH ALREADY
     printf("Page Directory Contains:\n");
@@ -232,8 +1224,15 @@ void print_pagetable(void)
     }
 }
 
+void print_pagetable(void)
+{
+    for (size_t i = 0; i < num_processes; i++) {
+        printf("Process %d:\n", processes[i]->pid);
+        print_directory(processes[i]->page_directory);
+    }
+}
 
-void free_pagetable(void)
+static void free_directory(pt_directory_t *page_directory)
 {
     // Iterate through the page table at every level and free them from bottom up.
     for (int i = 0; i < NUM_ENTRIES; i++) {
@@ -262,3 +1261,15 @@ void free_pagetable(void)
     }
     free369(page_directory);
 }
+
+void free_pagetable(void)
+{
+    for (size_t i = 0; i < num_processes; i++) {
+        free_directory(processes[i]->page_directory);
+        free369(processes[i]);
+    }
+    free369(processes);
+    if (tlb_entries > 0) {
+        tlb_destroy();
+    }
+}
@@ -23,9 +23,18 @@
 typedef struct pt_entry_s {
     unsigned int frame_number;
     off_t swap_offset;
+    uint64_t vpn : 36; // Virtual page number, used to find neighbouring pages
+    uint64_t asid : 16; // Address space (process) that the page belongs to
     bool valid : 1;
     bool dirty : 1;
     bool referenced : 1;
+    bool readahead : 1; // Brought in by readahead, not referenced since
+    bool cleaned : 1;   // Written to swap by the cleaner, not dirtied since
+    bool shared : 1;    // Shared mapping: writes go to the shared page
+    // Reverse map. All entries that map the same page are linked in a
+    // circular list. Unless the page is a shared mapping, it is
+    // copy-on-write as long as the list has more than one entry.
+    struct pt_entry_s *rmap_next;
 } pt_entry_t;
 
 // I decided to use a 4 level page table design with 9 bits to index into per level.
@@ -51,4 +60,20 @@ typedef struct pt_directory_s {
     pt_top_t* entries[NUM_ENTRIES];
 } pt_directory_t;
 
+// A simulated process. Processes are identified in the trace by their pid,
+// and internally by an address space identifier (ASID), which tags their
+// page table entries, TLB entries and the frames holding their pages.
+typedef struct process_s {
+    int pid;
+    unsigned int asid;
+    pt_directory_t *page_directory;
+    size_t ref_count;
+    size_t hit_count;
+    size_t miss_count;
+    size_t resident; // Number of frames holding this process's pages
+    bool exited;
+} process_t;
+
+#define MAX_ASIDS (1 << 16)
+
 #endif /* __PAGETABLE_H__ */
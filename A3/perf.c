@@ -0,0 +1,356 @@
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_X86 1
+#endif
+#include "perf.h"
+
+#define CALIBRATE_ROUNDS 4096 // Empty samples taken to measure overhead
+
+enum perf_counter {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_LLC_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_COUNTERS
+};
+
+static const struct {
+	const char *name;
+	uint64_t config;
+} counters[PERF_COUNTERS] = {
+	[PERF_CYCLES] = { "cycles", PERF_COUNT_HW_CPU_CYCLES },
+	[PERF_INSTRUCTIONS] = { "instructions", PERF_COUNT_HW_INSTRUCTIONS },
+	[PERF_LLC_MISSES] = { "LLC misses", PERF_COUNT_HW_CACHE_MISSES },
+	[PERF_BRANCH_MISSES] = { "branch misses", PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+bool perf_enabled = false;
+bool perf_per_call = false;
+
+static int group_fd = -1;           // The cycles counter leads the group
+static int fds[PERF_COUNTERS];
+static int slot[PERF_COUNTERS];     // Position in a group read, or -1
+static struct perf_event_mmap_page *pages[PERF_COUNTERS]; // With rdpmc
+static size_t page_size;
+static int num_open;
+static bool use_clock;              // No counters, time with clock_ticks()
+static bool use_rdpmc;
+
+static uint64_t start[PERF_PHASES][PERF_COUNTERS];
+static bool start_ok[PERF_PHASES];
+static uint64_t total[PERF_PHASES][PERF_COUNTERS];
+static size_t calls[PERF_PHASES];
+static size_t failed[PERF_PHASES]; // Samples dropped because a read failed
+
+// What taking a sample adds to the counts, taken out in the report: to
+// the phase being sampled, per call, and to the phase around it, per
+// nested call
+static double self_cost[PERF_COUNTERS];
+static double nested_cost[PERF_COUNTERS];
+
+// Without counters, cycles are timed with the TSC, or the raw monotonic
+// clock on CPUs that don't have one
+static inline uint64_t clock_ticks(void)
+{
+#ifdef HAVE_X86
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+#ifdef HAVE_X86
+#define CLOCK_NAME "the TSC"
+#define CLOCK_UNIT "TSC ticks"
+#else
+#define CLOCK_NAME "the monotonic clock"
+#define CLOCK_UNIT "ns"
+#endif
+
+static int open_counter(uint64_t config, int group)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	attr.disabled = (group < 0); // The leader starts the whole group
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+// Map each counter's control page, so it can be read with rdpmc instead
+// of a system call. Returns false if any counter can't be.
+static bool map_counters(void)
+{
+#ifdef HAVE_X86
+	page_size = sysconf(_SC_PAGESIZE);
+	for (int c = 0; c < PERF_COUNTERS; ++c) {
+		if (fds[c] < 0) {
+			continue;
+		}
+		void *p = mmap(NULL, page_size, PROT_READ, MAP_SHARED, fds[c], 0);
+		if (p == MAP_FAILED) {
+			return false;
+		}
+		pages[c] = p;
+		if (!pages[c]->cap_user_rdpmc) {
+			return false;
+		}
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+static void unmap_counters(void)
+{
+	for (int c = 0; c < PERF_COUNTERS; ++c) {
+		if (pages[c] != NULL) {
+			munmap(pages[c], page_size);
+			pages[c] = NULL;
+		}
+	}
+}
+
+#ifdef HAVE_X86
+// The kernel's recipe for reading a counter from user space: the count
+// so far is the page's offset plus the hardware counter, sign extended
+// from its width, read under the page's sequence lock. An index of 0
+// means the counter isn't on the PMU right now and offset is the count.
+static inline uint64_t rdpmc_counter(const volatile struct perf_event_mmap_page *pc)
+{
+	uint32_t seq;
+	uint64_t count;
+	do {
+		seq = pc->lock;
+		__atomic_signal_fence(__ATOMIC_SEQ_CST);
+		uint32_t idx = pc->index;
+		count = pc->offset;
+		if (idx != 0) {
+			int shift = 64 - pc->pmc_width;
+			int64_t pmc = (int64_t)(__rdpmc(idx - 1) << shift) >> shift;
+			count += pmc;
+		}
+		__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	} while (pc->lock != seq);
+	return count;
+}
+#endif
+
+// Returns false if the counters couldn't be read
+static inline bool read_counters(uint64_t values[PERF_COUNTERS])
+{
+	if (use_clock) {
+		values[PERF_CYCLES] = clock_ticks();
+		return true;
+	}
+#ifdef HAVE_X86
+	if (use_rdpmc) {
+		for (int c = 0; c < PERF_COUNTERS; ++c) {
+			if (pages[c] != NULL) {
+				values[c] = rdpmc_counter(pages[c]);
+			}
+		}
+		return true;
+	}
+#endif
+	// With PERF_FORMAT_GROUP: the number of counters, then their values
+	uint64_t buf[1 + PERF_COUNTERS];
+	if (read(group_fd, buf, sizeof(buf)) != (ssize_t)((1 + num_open) * sizeof(uint64_t))) {
+		return false;
+	}
+	for (int c = 0; c < PERF_COUNTERS; ++c) {
+		if (slot[c] >= 0) {
+			values[c] = buf[1 + slot[c]];
+		}
+	}
+	return true;
+}
+
+// Measure self_cost with empty samples, and nested_cost with empty
+// samples inside another one
+static void calibrate(void)
+{
+	uint64_t a[PERF_COUNTERS] = { 0 };
+	uint64_t b[PERF_COUNTERS] = { 0 };
+	uint64_t outer[PERF_COUNTERS] = { 0 };
+	double empty[PERF_COUNTERS] = { 0 };
+
+	for (int c = 0; c < PERF_COUNTERS; ++c) {
+		self_cost[c] = 0.0;
+		nested_cost[c] = 0.0;
+	}
+	read_counters(a); // Warm up
+	for (int i = 0; i < CALIBRATE_ROUNDS; ++i) {
+		read_counters(a);
+		read_counters(b);
+		for (int c = 0; c < PERF_COUNTERS; ++c) {
+			empty[c] += b[c] - a[c];
+		}
+	}
+	read_counters(outer);
+	for (int i = 0; i < CALIBRATE_ROUNDS; ++i) {
+		read_counters(a);
+		read_counters(b);
+	}
+	read_counters(b);
+	for (int c = 0; c < PERF_COUNTERS; ++c) {
+		self_cost[c] = empty[c] / CALIBRATE_ROUNDS;
+		nested_cost[c] = ((b[c] - outer[c]) - self_cost[c]) / CALIBRATE_ROUNDS;
+	}
+}
+
+void perf_init(void)
+{
+	memset(total, 0, sizeof(total));
+	memset(calls, 0, sizeof(calls));
+	memset(failed, 0, sizeof(failed));
+	num_open = 0;
+	for (int c = 0; c < PERF_COUNTERS; ++c) {
+		fds[c] = -1;
+		slot[c] = -1;
+		pages[c] = NULL;
+	}
+	use_rdpmc = false;
+	group_fd = open_counter(counters[PERF_CYCLES].config, -1);
+	use_clock = (group_fd < 0);
+	if (!use_clock) {
+		fds[PERF_CYCLES] = group_fd;
+		slot[PERF_CYCLES] = num_open++;
+		// Any of the others may be missing on some CPUs
+		for (int c = PERF_CYCLES + 1; c < PERF_COUNTERS; ++c) {
+			fds[c] = open_counter(counters[c].config, group_fd);
+			if (fds[c] >= 0) {
+				slot[c] = num_open++;
+			}
+		}
+		use_rdpmc = map_counters();
+		if (!use_rdpmc) {
+			unmap_counters();
+		}
+		ioctl(group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+
+	// A read() per sample would cost more, and disturb the caches and
+	// branch predictors more, than most of what it measures, so without
+	// rdpmc only the whole phases are counted
+	perf_per_call = use_clock || use_rdpmc;
+	if (perf_per_call) {
+		calibrate();
+	}
+}
+
+void perf_destroy(void)
+{
+	unmap_counters();
+	for (int c = 0; c < PERF_COUNTERS; ++c) {
+		if (fds[c] >= 0) {
+			close(fds[c]);
+		}
+	}
+	group_fd = -1;
+}
+
+void perf_begin(enum perf_phase phase)
+{
+	start_ok[phase] = read_counters(start[phase]);
+}
+
+void perf_end(enum perf_phase phase)
+{
+	uint64_t now[PERF_COUNTERS] = { 0 };
+	calls[phase]++;
+	if (!read_counters(now) || !start_ok[phase]) {
+		failed[phase]++;
+		return;
+	}
+	for (int c = 0; c < PERF_COUNTERS; ++c) {
+		total[phase][c] += now[c] - start[phase][c];
+	}
+}
+
+static void report_line(const char *name, size_t ncalls, const double *counts,
+                        size_t refs)
+{
+	printf("\t%-14s %10zu", name, ncalls);
+	for (int c = 0; c < PERF_COUNTERS; ++c) {
+		if (slot[c] >= 0 || (use_clock && c == PERF_CYCLES)) {
+			printf(" %14.2f", refs ? counts[c] / refs : 0.0);
+		}
+	}
+	printf("\n");
+}
+
+void perf_report(size_t refs)
+{
+	// Take out what sampling added, in each phase and the ones around it
+	size_t nested[PERF_PHASES] = {
+		[PERF_REPLAY] = calls[PERF_ACCESS] + calls[PERF_REF] + calls[PERF_EVICT],
+		[PERF_ACCESS] = calls[PERF_REF] + calls[PERF_EVICT],
+	};
+	double counts[PERF_PHASES][PERF_COUNTERS];
+	for (int p = 0; p < PERF_PHASES; ++p) {
+		size_t sampled = calls[p] - failed[p];
+		for (int c = 0; c < PERF_COUNTERS; ++c) {
+			counts[p][c] = total[p][c] - sampled * self_cost[c] -
+			               nested[p] * nested_cost[c];
+		}
+	}
+	double parse[PERF_COUNTERS];
+	double walk[PERF_COUNTERS];
+	for (int c = 0; c < PERF_COUNTERS; ++c) {
+		parse[c] = counts[PERF_REPLAY][c] - counts[PERF_ACCESS][c];
+		walk[c] = counts[PERF_ACCESS][c] - counts[PERF_REF][c] - counts[PERF_EVICT][c];
+	}
+
+	if (use_clock) {
+		printf("Performance counters unavailable, timing with %s:\n", CLOCK_NAME);
+	} else {
+		printf("Performance counters (user mode, read with %s):\n",
+		       use_rdpmc ? "rdpmc" : "read()");
+	}
+	printf("\t%-14s %10s", "per reference", "calls");
+	for (int c = 0; c < PERF_COUNTERS; ++c) {
+		if (slot[c] >= 0) {
+			printf(" %14s", counters[c].name);
+		} else if (use_clock && c == PERF_CYCLES) {
+			printf(" %14s", CLOCK_UNIT);
+		}
+	}
+	printf("\n");
+	report_line("init", calls[PERF_INIT], counts[PERF_INIT], refs);
+	report_line("replay", calls[PERF_REPLAY], counts[PERF_REPLAY], refs);
+	if (perf_per_call) {
+		report_line("  parsing", calls[PERF_REPLAY], parse, refs);
+		report_line("  access", calls[PERF_ACCESS], counts[PERF_ACCESS], refs);
+		report_line("    page table", calls[PERF_ACCESS], walk, refs);
+		report_line("    ref", calls[PERF_REF], counts[PERF_REF], refs);
+		report_line("    evict", calls[PERF_EVICT], counts[PERF_EVICT], refs);
+	} else {
+		printf("\tPer-reference phases need rdpmc, which isn't available\n");
+	}
+
+	size_t dropped = 0;
+	for (int p = 0; p < PERF_PHASES; ++p) {
+		dropped += failed[p];
+	}
+	if (dropped > 0) {
+		printf("\t%zu samples dropped because the counters couldn't be read\n",
+		       dropped);
+	}
+}
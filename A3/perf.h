@@ -0,0 +1,50 @@
+#ifndef __PERF_H__
+#define __PERF_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Hardware performance counters for the phases of a simulation, for -P.
+// Cycles, instructions, last level cache misses and branch misses are
+// counted in user mode with perf_event_open. If the counters can't be
+// opened (no PMU, or perf_event_paranoid forbids it), cycles are measured
+// with the time stamp counter instead, and the other counters are left
+// out. On CPUs without a TSC, the raw monotonic clock stands in for it.
+//
+// Phases can nest: a reference's access includes the algorithm's ref and
+// evict calls, and replay includes every access. The report derives the
+// time spent parsing the trace (replay less access) and in the page table
+// and the rest of the fault path (access less ref and evict).
+//
+// Per-reference phases are only sampled if that is cheap: with rdpmc on
+// the counters' mmap'd control pages, or with the TSC. A read() system
+// call per sample would mostly measure itself. What a sample costs is
+// measured at start up and taken out of the counts.
+
+enum perf_phase {
+	PERF_INIT,   // Page table, algorithm and other initialization
+	PERF_REPLAY, // Replaying the whole trace
+	PERF_ACCESS, // Simulating one reference
+	PERF_REF,    // The algorithm's ref function
+	PERF_EVICT,  // The algorithm's evict function
+	PERF_PHASES
+};
+
+// Set by sim.c
+extern bool perf_enabled;
+
+// Set by perf_init(): whether the access, ref and evict phases should be
+// sampled, or only init and replay
+extern bool perf_per_call;
+
+extern void perf_init(void);
+extern void perf_destroy(void);
+
+// Count the events between the two calls towards phase
+extern void perf_begin(enum perf_phase phase);
+extern void perf_end(enum perf_phase phase);
+
+// Print the counts, per reference
+extern void perf_report(size_t refs);
+
+#endif /* __PERF_H__ */
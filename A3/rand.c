@@ -1,6 +1,11 @@
 #include <stdlib.h>
+#include <string.h>
 #include "sim.h"
 #include "coremap.h"
+#include "snapshot.h"
+
+// State of random(), kept here so that it can be saved in a snapshot
+static long rand_state[16];
 
 /* Page to evict is chosen using the RAND algorithm.
  * Returns the page frame number (which is also the index in the coremap)
@@ -9,7 +14,11 @@
 int rand_evict(void)
 {
 	//NOTE: We keep the default seed (don't call srandom) for repeatable results
-	return random() % memsize;
+	int victim;
+	do {
+		victim = random() % memsize;
+	} while (!evictable(victim));
+	return victim;
 }
 
 /* This function is called on each access to a page to update any information
@@ -23,9 +32,59 @@ void rand_ref(int frame, vaddr_t vaddr)
 	(void)vaddr;
 }
 
+/* This function is called when a page is read ahead into frame, before it
+ * is used, to start keeping track of it.
+ */
+void rand_prefetch(int frame, vaddr_t vaddr)
+{
+	(void)frame;
+	(void)vaddr;
+}
+
+/* This function is called when the page in frame is freed without being
+ * evicted, to drop any information the algorithm keeps about it.
+ */
+void rand_drop(int frame)
+{
+	(void)frame;
+}
+
+/* This function is called when the pages in frames a and b trade places,
+ * where b may be free, to move any information the algorithm keeps about
+ * them.
+ */
+void rand_exchange(int a, int b)
+{
+	(void)a;
+	(void)b;
+}
+
+/* Save or restore the algorithm's state in a snapshot. setstate() records
+ * the generator's position in the state buffer, so the buffer is all that
+ * needs to be saved.
+ */
+void rand_save(void)
+{
+	setstate((char *)rand_state);
+	SNAP_WRITE(rand_state);
+}
+
+void rand_restore(void)
+{
+	// setstate() writes the position of the current state into its
+	// buffer, so load the saved state from a copy before switching back
+	long saved[16];
+	SNAP_READ(saved);
+	setstate((char *)saved);
+	memcpy(rand_state, saved, sizeof(rand_state));
+	setstate((char *)rand_state);
+}
+
 /* Initialize any data structures needed for this replacement algorithm. */
 void rand_init(void)
 {
+	// Same sequence as the default state, which is seeded with 1
+	initstate(1, (char *)rand_state, sizeof(rand_state));
 }
 
 /* Cleanup any data structures created in rand_init(). */
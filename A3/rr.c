@@ -1,18 +1,23 @@
 #include "sim.h"
 #include "coremap.h"
+#include "snapshot.h"
+
+static int rr_hand = 0;
 
 
 /* Page to evict is chosen using the Round Robin algorithm.
- * Since our simulated traces have only one process that never frees
- * memory regions, this is equivalent to FIFO.
+ * As long as the trace never frees memory (with an exit or an unmap), this
+ * is equivalent to FIFO.
  * Returns the page frame number (which is also the index in the coremap)
  * for the page that is to be evicted.
  */
 int rr_evict(void)
 {
-	static int i = 0;
-	int victim = i;
-	i = (i + 1) % memsize;
+	int victim;
+	do {
+		victim = rr_hand;
+		rr_hand = (rr_hand + 1) % memsize;
+	} while (!evictable(victim));
 	return victim;
 }
 
@@ -27,6 +32,44 @@ void rr_ref(int frame, vaddr_t vaddr)
 	(void)vaddr;
 }
 
+/* This function is called when a page is read ahead into frame, before it
+ * is used, to start keeping track of it.
+ */
+void rr_prefetch(int frame, vaddr_t vaddr)
+{
+	(void)frame;
+	(void)vaddr;
+}
+
+/* This function is called when the page in frame is freed without being
+ * evicted, to drop any information the algorithm keeps about it.
+ */
+void rr_drop(int frame)
+{
+	(void)frame;
+}
+
+/* This function is called when the pages in frames a and b trade places,
+ * where b may be free, to move any information the algorithm keeps about
+ * them.
+ */
+void rr_exchange(int a, int b)
+{
+	(void)a;
+	(void)b;
+}
+
+/* Save or restore the algorithm's state in a snapshot. */
+void rr_save(void)
+{
+	SNAP_WRITE(rr_hand);
+}
+
+void rr_restore(void)
+{
+	SNAP_READ(rr_hand);
+}
+
 /* Initialize any data structures needed for this replacement algorithm. */
 void rr_init(void)
 {
@@ -1,28 +1,48 @@
+#include <string.h>
+#include "malloc369.h"
 #include "sim.h"
 #include "coremap.h"
+#include "snapshot.h"
 
 list_head lru_queue; // Am queue
 list_head fifo_queue; // A1 queue
 int fifo_size;
 int fifo_threshold;
+static bool *prefetched; // Per frame: read ahead into A1, not used yet
 
 
+/* Returns the first frame in queue that may be evicted, or NULL */
+static list_entry *first_evictable(list_head *queue)
+{
+    list_entry *pos;
+    list_for_each(pos, queue) {
+        if (evictable(container_of(pos, struct frame, framelist_entry) - coremap)) {
+            return pos;
+        }
+    }
+    return NULL;
+}
+
 /* Page to evict is chosen using the simplified 2Q algorithm.
  * Returns the page frame number (which is also the index in the coremap)
  * for the page that is to be evicted.
  */
 int s2q_evict(void)
 {
-    list_entry *entry;
-    if (fifo_size > fifo_threshold){
-        entry = list_first_entry(&fifo_queue);
+    list_head *queue = (fifo_size > fifo_threshold) ? &fifo_queue : &lru_queue;
+    list_entry *entry = first_evictable(queue);
+    if (!entry) { // Nothing we can take from that queue, so try the other
+        queue = (queue == &fifo_queue) ? &lru_queue : &fifo_queue;
+        entry = first_evictable(queue);
+        assert(entry);
+    }
+    if (queue == &fifo_queue) {
         fifo_size -= 1;
-    } else {
-        entry = list_first_entry(&lru_queue);
     }
     struct frame *to_evict = container_of(entry, struct frame, framelist_entry);
     list_del(entry);
     set_referenced(to_evict->pte, 0);
+    prefetched[to_evict - coremap] = false;
 	return (to_evict - coremap);
 }
 
@@ -37,6 +57,10 @@ void s2q_ref(int frame, vaddr_t vaddr)
         list_add_tail(&fifo_queue, &coremap[frame].framelist_entry);
         set_referenced(coremap[frame].pte, 0);
         fifo_size ++;
+    } else if (prefetched[frame]) { // Read ahead, so this is its first reference
+        list_del(&coremap[frame].framelist_entry);
+        list_add_tail(&fifo_queue, &coremap[frame].framelist_entry);
+        prefetched[frame] = false;
     } else if (get_referenced(coremap[frame].pte)) { // It has been referenced and moved to Am LRU queue
         list_del(&coremap[frame].framelist_entry);
         list_add_tail(&lru_queue, &coremap[frame].framelist_entry);
@@ -50,6 +74,107 @@ void s2q_ref(int frame, vaddr_t vaddr)
 	(void)vaddr; // To keep the compiler from crying
 }
 
+/* This function is called when a page is read ahead into frame, before it
+ * is used. It goes in A1 like a page referenced for the first time, but
+ * its first use counts as that first reference, not as a second one.
+ */
+void s2q_prefetch(int frame, vaddr_t vaddr)
+{
+    list_add_tail(&fifo_queue, &coremap[frame].framelist_entry);
+    set_referenced(coremap[frame].pte, 0);
+    fifo_size++;
+    prefetched[frame] = true;
+    (void)vaddr;
+}
+
+/* This function is called when the page in frame is freed without being
+ * evicted, to drop any information the algorithm keeps about it.
+ * Pages in the A1 queue are the unreferenced ones.
+ */
+void s2q_drop(int frame)
+{
+    if (list_entry_is_linked(&coremap[frame].framelist_entry)) {
+        if (!get_referenced(coremap[frame].pte)) {
+            fifo_size--;
+        }
+        list_del(&coremap[frame].framelist_entry);
+    }
+    prefetched[frame] = false;
+}
+
+/* Puts entry in the place of old in its queue, if it is in one */
+static void replace_entry(list_entry *old, list_entry *entry)
+{
+    if (!list_entry_is_linked(old)) {
+        list_entry_init(entry);
+        return;
+    }
+    __list_insert(entry, old->prev, old->next);
+    list_entry_init(old);
+}
+
+/* This function is called when the pages in frames a and b trade places,
+ * where b may be free. Each page keeps its place in its queue, and whether
+ * it was read ahead. Its referenced bit, which tells the queues apart,
+ * moves with its page table entry.
+ */
+void s2q_exchange(int a, int b)
+{
+    list_entry tmp;
+    replace_entry(&coremap[a].framelist_entry, &tmp);
+    replace_entry(&coremap[b].framelist_entry, &coremap[a].framelist_entry);
+    replace_entry(&tmp, &coremap[b].framelist_entry);
+    bool p = prefetched[a];
+    prefetched[a] = prefetched[b];
+    prefetched[b] = p;
+}
+
+static void save_queue(list_head *queue)
+{
+    size_t count = 0;
+    list_entry *pos;
+    list_for_each(pos, queue) {
+        count++;
+    }
+    SNAP_WRITE(count);
+    list_for_each(pos, queue) {
+        int frame = container_of(pos, struct frame, framelist_entry) - coremap;
+        SNAP_WRITE(frame);
+    }
+}
+
+static void restore_queue(list_head *queue)
+{
+    size_t count;
+    SNAP_READ(count);
+    for (size_t i = 0; i < count; i++) {
+        int frame;
+        SNAP_READ(frame);
+        list_add_tail(queue, &coremap[frame].framelist_entry);
+    }
+}
+
+/* Save or restore the algorithm's state in a snapshot: both queues, in
+ * order, as lists of frame numbers, and which frames were read ahead.
+ */
+void s2q_save(void)
+{
+    save_queue(&fifo_queue);
+    save_queue(&lru_queue);
+    SNAP_WRITE(fifo_size);
+    SNAP_WRITE(fifo_threshold);
+    snap_write(prefetched, memsize * sizeof(bool));
+}
+
+void s2q_restore(void)
+{
+    restore_queue(&fifo_queue);
+    restore_queue(&lru_queue);
+    SNAP_READ(fifo_size);
+    SNAP_READ(fifo_threshold);
+    snap_read(prefetched, memsize * sizeof(bool));
+}
+
 /* Initialize any data structures needed for this replacement algorithm. */
 void s2q_init(void)
 {
@@ -57,6 +182,8 @@ void s2q_init(void)
     list_init(&fifo_queue);
     fifo_size = 0;
     fifo_threshold = memsize / 10;
+    prefetched = malloc369(memsize * sizeof(bool));
+    memset(prefetched, 0, memsize * sizeof(bool));
 }
 
 /* Cleanup any data structures created in s2q_init(). */
@@ -65,4 +192,5 @@ void s2q_cleanup(void)
     // I mean, technically this does nothing, but whatever
     list_destroy(&lru_queue);
     list_destroy(&fifo_queue);
+    free369(prefetched);
 }
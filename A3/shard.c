@@ -0,0 +1,350 @@
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include "sim.h"
+#include "cache.h"
+#include "cleaner.h"
+#include "coremap.h"
+#include "cost.h"
+#include "swap.h"
+#include "tlb.h"
+#include "zswap.h"
+#include "shard.h"
+
+#define RING_SIZE 8192 // Records per ring, a power of 2
+#define CACHE_LINE 64
+#define SPINS 64       // Polls of an empty or full ring before yielding
+#define CHECK_SPINS 4096 // Polls of a full ring between checks on the worker
+
+// One ring per worker. The producer only writes tail and the consumer
+// only writes head, each on its own cache line, so a record costs one
+// release store on each side. Both sides keep a private copy of the
+// other's index and only reload it when the ring looks full or empty.
+struct ring {
+	_Alignas(CACHE_LINE) _Atomic size_t head; // Next record to consume
+	_Alignas(CACHE_LINE) _Atomic size_t tail; // Next free slot
+	struct trace_rec recs[RING_SIZE];
+};
+
+size_t shard_count = 0;
+
+static struct ring *rings;
+static size_t rings_len;
+static struct shard_result *results; // One per group, shared
+static size_t results_len;
+static size_t group_count;
+static pid_t *workers;
+static FILE **outputs;    // Each group's per-process statistics
+static size_t *head_seen; // Producer's copy of each ring's head
+static size_t tail_seen;  // Consumer's copy of its ring's tail
+
+// Worker side. spools[i] holds the records of the worker's group
+// shard + (i + 1) * shard_count until the trace has ended.
+static int worker_shard;
+static FILE **spools;
+static size_t spools_len;
+static bool live;                 // This simulation reads the ring
+static volatile pid_t simulation; // The worker's current simulation
+
+static void close_outputs(void)
+{
+	for (size_t i = 0; i < group_count; ++i) {
+		fclose(outputs[i]);
+	}
+	free(outputs);
+}
+
+// Don't outlive the parent, or a worker would wait forever
+static void follow_parent(pid_t parent)
+{
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+	if (getppid() != parent) {
+		exit(1);
+	}
+}
+
+// A worker that is stopped stops its simulation, which removes its swapfile
+static void worker_term_handler(int signum)
+{
+	(void)signum;
+	if (simulation > 0) {
+		kill(simulation, SIGTERM);
+		waitpid(simulation, NULL, 0);
+	}
+	_exit(1);
+}
+
+// Run worker shard: simulate each of its groups in turn, each in a process
+// of its own. Returns the group in each simulation, and exits in the
+// worker when all of them are done.
+static int run_worker(int shard)
+{
+	struct sigaction sig_action;
+	memset(&sig_action, 0, sizeof(sig_action));
+	sig_action.sa_handler = worker_term_handler;
+	sigemptyset(&sig_action.sa_mask);
+	sigaction(SIGTERM, &sig_action, NULL);
+
+	worker_shard = shard;
+	spools_len = (group_count - shard - 1) / shard_count;
+	spools = calloc(spools_len, sizeof(FILE *));
+	for (size_t i = 0; i < spools_len; ++i) {
+		spools[i] = tmpfile();
+		if (spools[i] == NULL) {
+			perror("Failed to create shard spool file");
+			exit(1);
+		}
+	}
+
+	int failed = 0;
+	pid_t worker = getpid();
+	for (size_t g = shard; g < group_count; g += shard_count) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			exit(1);
+		}
+		if (pid == 0) {
+			follow_parent(worker);
+			live = (g == (size_t)shard);
+			if (!live) {
+				rewind(spools[(g - shard) / shard_count - 1]);
+			}
+			return g;
+		}
+		simulation = pid;
+		int status;
+		if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status) != 0 || !results[g].done) {
+			failed = 1;
+		}
+		simulation = 0;
+		if (failed) {
+			break;
+		}
+	}
+	exit(failed);
+}
+
+int shard_start(size_t ngroups)
+{
+	group_count = ngroups;
+	if (shard_count > group_count) {
+		shard_count = group_count;
+	}
+	rings_len = shard_count * sizeof(struct ring);
+	rings = mmap(NULL, rings_len, PROT_READ | PROT_WRITE,
+	             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	results_len = group_count * sizeof(struct shard_result);
+	results = mmap(NULL, results_len, PROT_READ | PROT_WRITE,
+	               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (rings == MAP_FAILED || results == MAP_FAILED) {
+		perror("Failed to map shard rings");
+		exit(1);
+	}
+	workers = calloc(shard_count, sizeof(pid_t));
+	head_seen = calloc(shard_count, sizeof(size_t));
+	outputs = calloc(group_count, sizeof(FILE *));
+	for (size_t i = 0; i < group_count; ++i) {
+		outputs[i] = tmpfile();
+		if (outputs[i] == NULL) {
+			perror("Failed to create shard output file");
+			exit(1);
+		}
+	}
+
+	// Anything still buffered would be written by every worker too
+	fflush(stdout);
+	fflush(stderr);
+	pid_t parent = getpid();
+	for (size_t i = 0; i < shard_count; ++i) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			exit(1);
+		}
+		if (pid == 0) {
+			follow_parent(parent);
+			free(workers);
+			free(head_seen);
+			tail_seen = 0;
+			return run_worker(i);
+		}
+		workers[i] = pid;
+	}
+	return -1;
+}
+
+void shard_push(int shard, const struct trace_rec *rec)
+{
+	struct ring *r = &rings[shard];
+	size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	for (int spins = 0; tail - head_seen[shard] == RING_SIZE; ++spins) {
+		head_seen[shard] = atomic_load_explicit(&r->head, memory_order_acquire);
+		if (spins >= SPINS) {
+			sched_yield();
+		}
+		// A worker that has failed will never make room
+		if (spins % CHECK_SPINS == CHECK_SPINS - 1 &&
+		    waitpid(workers[shard], NULL, WNOHANG) != 0) {
+			fprintf(stderr, "Shard %d failed\n", shard);
+			workers[shard] = 0;
+			shard_abort();
+			exit(1);
+		}
+	}
+	r->recs[tail & (RING_SIZE - 1)] = *rec;
+	atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+// Take the next record from the worker's ring
+static void ring_pop(struct trace_rec *rec)
+{
+	struct ring *r = &rings[worker_shard];
+	size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	for (int spins = 0; head == tail_seen; ++spins) {
+		tail_seen = atomic_load_explicit(&r->tail, memory_order_acquire);
+		if (spins >= SPINS) {
+			sched_yield();
+		}
+	}
+	*rec = r->recs[head & (RING_SIZE - 1)];
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+bool shard_pop(int group, struct trace_rec *rec)
+{
+	if (!live) {
+		FILE *spool = spools[(group - worker_shard) / shard_count - 1];
+		return fread(rec, sizeof(*rec), 1, spool) == 1;
+	}
+	for (;;) {
+		ring_pop(rec);
+		if (rec->type == 'E') {
+			break;
+		}
+		if (rec->group == group) {
+			return true;
+		}
+		FILE *spool = spools[(rec->group - worker_shard) / shard_count - 1];
+		if (fwrite(rec, sizeof(*rec), 1, spool) != 1) {
+			perror("Failed to write shard spool file");
+			exit(1);
+		}
+	}
+	for (size_t i = 0; i < spools_len; ++i) {
+		if (fflush(spools[i]) != 0) {
+			perror("Failed to write shard spool file");
+			exit(1);
+		}
+	}
+	return false;
+}
+
+struct shard_result *shard_result(int group)
+{
+	return &results[group];
+}
+
+void shard_report(int group)
+{
+	struct shard_result *r = &results[group];
+#define X(name) r->name = name;
+	SHARD_COUNTERS
+#undef X
+	r->evict_fanout_max = evict_fanout_max;
+	r->frames_saved = pages_saved_by_sharing();
+	r->simulated_ns = simulated_ns;
+	r->cleaner_write_time = cleaner_write_time;
+	memcpy(r->cache_stats, cache_stats, sizeof(r->cache_stats));
+	print_process_lines(outputs[group]);
+	fflush(outputs[group]);
+}
+
+struct shard_result shard_merge(void)
+{
+	struct shard_result total = { .leak_free = true };
+	for (size_t i = 0; i < group_count; ++i) {
+		struct shard_result *r = &results[i];
+#define X(name) total.name += r->name;
+		SHARD_COUNTERS
+#undef X
+		if (r->evict_fanout_max > total.evict_fanout_max) {
+			total.evict_fanout_max = r->evict_fanout_max;
+		}
+		total.frames_saved += r->frames_saved;
+		total.simulated_ns += r->simulated_ns;
+		total.cleaner_write_time += r->cleaner_write_time;
+		for (int l = 0; l < CACHE_MAX_LEVELS; ++l) {
+			total.cache_stats[l].hits += r->cache_stats[l].hits;
+			total.cache_stats[l].compulsory += r->cache_stats[l].compulsory;
+			total.cache_stats[l].capacity += r->cache_stats[l].capacity;
+			total.cache_stats[l].conflict += r->cache_stats[l].conflict;
+		}
+		total.processes += r->processes;
+		total.leak_free = total.leak_free && r->leak_free;
+	}
+#define X(name) name = total.name;
+	SHARD_COUNTERS
+#undef X
+	evict_fanout_max = total.evict_fanout_max;
+	simulated_ns = total.simulated_ns;
+	cleaner_write_time = total.cleaner_write_time;
+	memcpy(cache_stats, total.cache_stats, sizeof(cache_stats));
+	return total;
+}
+
+FILE *shard_output(int group)
+{
+	return outputs[group];
+}
+
+void shard_print_processes(void)
+{
+	char buf[4096];
+	size_t n;
+	fflush(stdout);
+	for (size_t i = 0; i < group_count; ++i) {
+		rewind(outputs[i]);
+		while ((n = fread(buf, 1, sizeof(buf), outputs[i])) > 0) {
+			fwrite(buf, 1, n, stdout);
+		}
+	}
+	close_outputs();
+}
+
+void shard_abort(void)
+{
+	for (size_t i = 0; i < shard_count; ++i) {
+		if (workers[i] > 0) {
+			kill(workers[i], SIGTERM);
+			waitpid(workers[i], NULL, 0);
+		}
+	}
+	free(workers);
+	free(head_seen);
+	close_outputs();
+}
+
+int shard_wait(void)
+{
+	int ret = 0;
+	for (size_t i = 0; i < shard_count; ++i) {
+		int status;
+		if (waitpid(workers[i], &status, 0) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "Shard %zu failed\n", i);
+			ret = -1;
+		}
+	}
+	free(workers);
+	free(head_seen);
+	return ret;
+}
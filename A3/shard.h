@@ -0,0 +1,98 @@
+#ifndef __SHARD_H__
+#define __SHARD_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "sim.h"
+#include "cache.h"
+#include "stream.h"
+
+// Sharded simulation of multi-process traces. Each process has a fixed
+// share of physical memory and swap. Processes that share pages, by fork
+// or attach, form a group, and each group is simulated on its own, with
+// its own page tables, coremap and replacement algorithm state, so the
+// results don't depend on the number of workers. Groups are numbered in
+// the order they first appear in the trace, and group g goes to worker
+// g % shard_count. The parent process parses the trace and hands every
+// record, tagged with its pid and group, to the worker for its group
+// through a single-producer, single-consumer ring in shared memory.
+//
+// Each group is simulated by a fresh process, forked by its worker, so
+// that it starts from the same state whichever worker it is given to.
+// The first group of a worker is simulated as its records arrive, and
+// the records of the worker's other groups are set aside in temporary
+// files, to be simulated one after another once the trace has ended.
+// At the end, each group leaves its counters in shared memory for the
+// parent to merge, and writes its per-process statistics to a temporary
+// file for the parent to print.
+//
+// Workers are forked processes rather than threads, which gives each one
+// a private copy of all of the simulator's state for free.
+
+// Number of workers, set by sim.c. 0 disables sharding.
+extern size_t shard_count;
+
+// The counters a worker reports, each a global kept by its module. The
+// parser sums them over the workers into its own copies of the globals,
+// and then prints them as for a single simulation.
+#define SHARD_COUNTERS \
+	X(hit_count) X(miss_count) X(ref_count) \
+	X(evict_clean_count) X(evict_dirty_count) \
+	X(swap_read_calls) X(swap_write_calls) \
+	X(readahead_count) X(readahead_hit_count) \
+	X(cleaner_runs) X(cleaned_count) X(cleaned_evict_count) X(cleaned_wasted_count) \
+	X(zswap_loads) X(zswap_stores) X(zswap_same_pages) X(zswap_rejects) \
+	X(zswap_pool_bytes) X(zswap_pool_pages) X(zswap_pool_peak) X(zswap_pool_limit) \
+	X(swap_pageout_count) X(swap_pages_written) \
+	X(swap_wb_hits) X(swap_wb_stalls) \
+	X(tlb_hit_count) X(tlb_miss_count) \
+	X(shared_page_count) X(cow_fault_count) X(evict_mapping_count) \
+	X(unmap_page_count) X(unmap_frame_count) X(unmap_swap_count) \
+	X(color_match_count) X(color_fallback_count)
+
+// What the simulation of a group reports back
+struct shard_result {
+#define X(name) size_t name;
+	SHARD_COUNTERS
+#undef X
+	size_t evict_fanout_max;
+	size_t frames_saved; // By sharing, at the end
+	double simulated_ns;
+	double cleaner_write_time;
+	struct cache_stats cache_stats[CACHE_MAX_LEVELS];
+	size_t processes;
+	bool leak_free;
+	bool done;
+};
+
+// Set up the rings and fork the workers, for groups 0 to ngroups - 1.
+// Returns the group number in each simulation, and -1 in the parent.
+// Fewer workers than groups are never started.
+extern int shard_start(size_t ngroups);
+
+// Parent side: queue a record for a worker, waiting if its ring is full,
+// and wait for all workers to finish, or stop them early on an error.
+// shard_wait returns 0 if every group was simulated, -1 otherwise.
+extern void shard_push(int shard, const struct trace_rec *rec);
+extern int shard_wait(void);
+extern void shard_abort(void);
+
+// Simulation side: take the next record of the group. Returns false at the
+// end of the trace.
+extern bool shard_pop(int group, struct trace_rec *rec);
+
+// Each group's results, filled in from the globals by shard_report()
+extern struct shard_result *shard_result(int group);
+extern void shard_report(int group);
+
+// Parent side: sum the groups' results into the globals. Returns the
+// totals, with frames_saved, processes and leak_free merged too.
+extern struct shard_result shard_merge(void);
+
+// Where a group's simulation writes its per-process statistics, and the
+// parent side that prints them all, in group order
+extern FILE *shard_output(int group);
+extern void shard_print_processes(void);
+
+#endif /* __SHARD_H__ */
@@ -1,59 +1,72 @@
 #include <assert.h>
 #include <getopt.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
+#include <limits.h>
 #include <ucontext.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <signal.h>
 #include "malloc369.h"
 #include "sim.h"
 #include "coremap.h"
 #include "swap.h"
+#include "zswap.h"
+#include "cleaner.h"
+#include "tlb.h"
+#include "cache.h"
+#include "tier.h"
+#include "analysis.h"
+#include "shard.h"
+#include "stream.h"
+#include "perf.h"
+#include "interval.h"
+#include "cost.h"
+#include "snapshot.h"
 
 static void install_fatal_handlers(); /* To remove swapfile on failure */
 
 // Define global variables declared in sim.h
 size_t memsize = 0;
+size_t simpagesize = DEFAULT_SIMPAGESIZE;
 int debug = 0;
 unsigned char *physmem = NULL;
 struct frame *coremap = NULL;
 
 /* Each eviction algorithm is represented by a structure with its name
- * and three functions.
+ * and its functions.
  */
 struct functions {
 	const char *name;          // String name of eviction algorithm
 	void (*init)(void);        // Initialize any data needed by alg
 	void (*cleanup)(void);     // Cleanup any data initialized in init()
 	void (*ref)(int, vaddr_t); // Called on each reference
+	void (*prefetch)(int, vaddr_t); // Called when a page is read ahead
 	int (*evict)(void);        // Called to choose victim for eviction
+	void (*drop)(int);         // Called when a page is freed, not evicted
+	void (*exchange)(int, int); // Called when two frames trade pages
+	void (*save)(void);        // Save state in a snapshot
+	void (*restore)(void);     // Restore state from a snapshot
+	void (*replay)(FILE *, size_t); // replay_trace() specialized for this alg
+	void (*stream)(void);      // replay_stream() specialized for this alg
 };
 
-/* The algs array gives us a mapping between the name of an eviction
- * algorithm as given in a command line argument, and the function to
- * call to select the victim page.
- *
- * The list of REPLACEMENT_ALGORITHMS is found in coremap.h
- * We use the C preprocessor stringizing and concatenation operations to
- * create a template for the algorithm function structure.
- * See https://gcc.gnu.org/onlinedocs/cpp/Stringizing.html
- * and https://gcc.gnu.org/onlinedocs/cpp/Concatenation.html
- */
-static struct functions algs[] = {
-#define RA(name) \
-	{ #name, name ## _init, name ## _cleanup, name ## _ref, name ## _evict },
-REPLACEMENT_ALGORITHMS
-#undef RA
-};
-static int num_algs = sizeof(algs) / sizeof(algs[0]);
-
 static void (*init_func)() = NULL;
 static void (*cleanup_func)() = NULL;
 void (*ref_func)(int, vaddr_t) = NULL;
+void (*prefetch_func)(int, vaddr_t) = NULL;
 int (*evict_func)() = NULL;
+void (*drop_func)(int) = NULL;
+void (*exchange_func)(int, int) = NULL;
+void (*save_func)(void) = NULL;
+void (*restore_func)(void) = NULL;
+
+// Options that the simulation state depends on, checked when resuming
+static char *config;
 
 
 /* An actual memory access based on the vaddr from the trace file.
@@ -70,15 +83,24 @@ int (*evict_func)() = NULL;
  * virtual address) and, in case of a write reference, increment the version
  * counter.
  */
-static void
-access_mem(char type, vaddr_t vaddr, unsigned char val, size_t linenum)
+static inline __attribute__((always_inline)) void
+access_mem(char type, vaddr_t vaddr, unsigned char val, size_t linenum,
+           void (*ref)(int, vaddr_t))
 {
 	unsigned char *pgptr; 
 	unsigned char *memptr;
 	unsigned offset = vaddr % PAGE_SIZE;
 	
-	pgptr = find_physpage(vaddr, type);
+	// Same as find_physpage(), but with the algorithm's ref function
+	// known at compile time, so that it can be inlined.
+	int frame = find_frame_number(vaddr, type);
+	assert(frame != -1);
+	ref(frame, vaddr);
+	pgptr = &physmem[frame * simpagesize];
 	memptr = pgptr + offset;
+	if (cache_levels > 0) {
+		cache_access(frame * simpagesize + offset);
+	}
 
 	if ((type == 'S') || (type == 'M')) {
 		// write access to page, update value in simulated memory
@@ -91,41 +113,747 @@ access_mem(char type, vaddr_t vaddr, unsigned char val, size_t linenum)
 	}
 }
 
+/* Parse a reference line, "type vaddr value", like
+ * sscanf(line, "%c %zx %hhu", ...) would, but much faster, since this is
+ * on the replay loop's hot path. Returns 0 on success, -1 on error.
+ */
+static inline int
+parse_ref(const char *line, char *type, vaddr_t *vaddr, unsigned char *val)
+{
+	char *start;
+	char *end;
+	*type = line[0];
+	if (*type == '\0') {
+		return -1;
+	}
+	start = (char *)line + 1;
+	*vaddr = strtoul(start, &end, 16);
+	if (end == start) {
+		return -1;
+	}
+	start = end;
+	*val = strtoul(start, &end, 10);
+	return (end == start) ? -1 : 0;
+}
+
+static inline bool
+is_ref(char type)
+{
+	return type == 'I' || type == 'L' || type == 'S' || type == 'M';
+}
+
+/* Errors from decode_line() */
+enum {
+	DECODE_MALFORMED = -1,
+	DECODE_BAD_TYPE = -2,   // Not a known record or reference type
+	DECODE_BAD_OFFSET = -3, // Offset past the end of a simulated frame
+};
+
+/* Decode a trace line, for every way of replaying a trace:
+ *   type vaddr value      - a reference, where type is I, L, S or M
+ *   P pid                 - following references belong to process pid
+ *   F pid                 - fork the current process, creating process pid
+ *   X                     - the current process exits
+ *   A pid vaddr npages    - map npages pages at vaddr in process pid into
+ *                           the current process, shared
+ *   U vaddr npages        - unmap npages pages at vaddr in the current
+ *                           process
+ *   = ...                 - a comment
+ * Returns 0 for a record, 1 for a comment, or one of the errors above. For
+ * DECODE_BAD_OFFSET, rec is still filled in.
+ */
+static int
+decode_line(const char *line, struct trace_rec *rec)
+{
+	switch (line[0]) {
+	case '=':
+		return 1;
+	case 'P':
+	case 'F':
+		rec->type = line[0];
+		return (sscanf(line + 1, " %d", &rec->arg_pid) == 1) ? 0 : DECODE_MALFORMED;
+	case 'X':
+		rec->type = 'X';
+		return 0;
+	case 'A':
+		rec->type = 'A';
+		return (sscanf(line, "A %d %zx %zu", &rec->arg_pid, &rec->vaddr,
+		               &rec->arg) == 3) ? 0 : DECODE_MALFORMED;
+	case 'U':
+		rec->type = 'U';
+		return (sscanf(line, "U %zx %zu", &rec->vaddr, &rec->arg) == 2) ?
+		       0 : DECODE_MALFORMED;
+	}
+	if (parse_ref(line, &rec->type, &rec->vaddr, &rec->val) != 0) {
+		return DECODE_MALFORMED;
+	}
+	if (!is_ref(rec->type)) {
+		return DECODE_BAD_TYPE;
+	}
+	if ((rec->vaddr % PAGE_SIZE) >= simpagesize) {
+		return DECODE_BAD_OFFSET;
+	}
+	return 0;
+}
+
+/* Report a line that decode_line() rejected */
+static void
+report_invalid(size_t linenum, const char *line, int err)
+{
+	switch (err) {
+	case DECODE_BAD_TYPE:
+		fprintf(stderr, "Invalid reftype, line %zu: %s\n", linenum, line);
+		break;
+	case DECODE_BAD_OFFSET:
+		fprintf(stderr, "Invalid vaddr, offset must be in range of simulated "
+		        "page frame size, line %zu: %s\n", linenum, line);
+		break;
+	default:
+		fprintf(stderr, "Invalid trace line %zu: %s\n", linenum, line);
+	}
+}
+
+static void
+exit_invalid(size_t linenum, const char *line, int err)
+{
+	report_invalid(linenum, line, err);
+	exit(1);
+}
+
+/* Apply a record other than a reference to the simulation. Every way of
+ * replaying a trace comes through here, so that the replay loops only
+ * differ in how they make references. An attach or unmap that the page
+ * tables reject ends the simulation.
+ */
+static void
+apply_record(const struct trace_rec *rec)
+{
+	switch (rec->type) {
+	case 'P':
+		switch_process(rec->arg_pid);
+		return;
+	case 'F':
+		fork_process(rec->arg_pid);
+		return;
+	case 'X':
+		exit_process();
+		return;
+	case 'A':
+		if (attach_pages(rec->arg_pid, rec->vaddr, rec->arg) != 0) {
+			fprintf(stderr, "Invalid trace line %zu: A %d %lx %zu\n",
+			        rec->linenum, rec->arg_pid, rec->vaddr, rec->arg);
+			exit(1);
+		}
+		return;
+	case 'U':
+		if (unmap_pages(rec->vaddr, rec->arg) != 0) {
+			fprintf(stderr, "Invalid trace line %zu: U %lx %zu\n",
+			        rec->linenum, rec->vaddr, rec->arg);
+			exit(1);
+		}
+		return;
+	}
+	assert(false);
+}
+
+/* Open the trace file, where "-" is standard input */
+static FILE *
+open_trace(const char *tracefile)
+{
+	FILE *f = (strcmp(tracefile, "-") == 0) ? stdin : fopen(tracefile, "r");
+	if (!f) {
+		perror(tracefile);
+	}
+	return f;
+}
+
+/* Replay the trace from the current position of f, which is at line
+ * linenum + 1.
+ */
+static inline __attribute__((always_inline)) void
+replay_trace(FILE *f, size_t linenum, void (*ref)(int, vaddr_t), bool perf)
+{
+	char line[256];
+	struct trace_rec rec;
+	while (fgets(line, sizeof(line), f)) {
+		++linenum;
+		int ret = decode_line(line, &rec);
+		if (ret > 0) {
+			continue;
+		}
+		if (ret < 0) {
+			exit_invalid(linenum, line, ret);
+		}
+		rec.linenum = linenum;
+		if (!is_ref(rec.type)) {
+			apply_record(&rec);
+			continue;
+		}
+		if (debug > 1) {
+			printf("%c %lx %hhu\n", rec.type, rec.vaddr, rec.val);
+		}
+
+		if (perf) {
+			perf_begin(PERF_ACCESS);
+		}
+		access_mem(rec.type, rec.vaddr, rec.val, linenum, ref);
+		if (perf) {
+			perf_end(PERF_ACCESS);
+		}
+		interval_tick();
+		if (snapshot_interval > 0 && ref_count % snapshot_interval == 0) {
+			snapshot_save(config, ftell(f), linenum);
+		}
+	}
+}
+
+/* Replay a trace read from a pipe, as decoded into batches by the parser
+ * thread. Snapshots can't be taken, since the trace can't be seeked.
+ */
+static inline __attribute__((always_inline)) void
+replay_stream(void (*ref)(int, vaddr_t), bool perf)
+{
+	struct trace_rec *recs;
+	size_t n;
+	while ((n = stream_batch(&recs)) > 0) {
+		for (struct trace_rec *rec = recs; rec < recs + n; ++rec) {
+			if (!is_ref(rec->type)) {
+				apply_record(rec);
+				continue;
+			}
+			if (debug > 1) {
+				printf("%c %lx %hhu\n", rec->type, rec->vaddr, rec->val);
+			}
+			if (perf) {
+				perf_begin(PERF_ACCESS);
+			}
+			access_mem(rec->type, rec->vaddr, rec->val, rec->linenum, ref);
+			if (perf) {
+				perf_end(PERF_ACCESS);
+			}
+			interval_tick();
+		}
+	}
+}
+
+/* Make one pass over the trace for analysis mode, without simulating
+ * paging. Process events other than switches don't affect the analysis.
+ */
 static void
-replay_trace(FILE *f)
+analyze_trace(FILE *f)
 {
 	char line[256];
 	size_t linenum = 0;
+	struct trace_rec rec;
 	while (fgets(line, sizeof(line), f)) {
 		++linenum;
+		// Offsets only matter to a simulation with a frame size
+		int ret = decode_line(line, &rec);
+		if (ret > 0) {
+			continue;
+		}
+		if (ret < 0 && ret != DECODE_BAD_OFFSET) {
+			exit_invalid(linenum, line, ret);
+		}
+		if (rec.type == 'P') {
+			analysis_process(rec.arg_pid);
+		} else if (is_ref(rec.type)) {
+			analysis_ref(rec.type, rec.vaddr);
+		}
+	}
+}
+
+/* Replay the records of a group of processes in sharded mode, as handed
+ * over by the parser in run_sharded(). The trace has already been checked.
+ */
+static void
+replay_shard(int group)
+{
+	struct trace_rec rec;
+	int pid = INT_MIN;
+	while (shard_pop(group, &rec)) {
+		if (rec.pid != pid) {
+			switch_process(rec.pid);
+			pid = rec.pid;
+		}
+		if (is_ref(rec.type)) {
+			access_mem(rec.type, rec.vaddr, rec.val, rec.linenum, ref_func);
+		} else {
+			apply_record(&rec);
+		}
+	}
+}
+
+/* Generate a copy of replay_trace() and replay_stream() for each
+ * replacement algorithm, with calls to its ref function made directly
+ * rather than through ref_func.
+ * The compiler can then inline the function, and with link-time
+ * optimization, the page table accessors it uses, into the replay loop.
+ */
+#define RA(name) \
+	static void replay_trace_ ## name(FILE *f, size_t linenum) \
+	{ replay_trace(f, linenum, name ## _ref, false); } \
+	static void replay_stream_ ## name(void) \
+	{ replay_stream(name ## _ref, false); }
+REPLACEMENT_ALGORITHMS
+#undef RA
+
+/* With -P, if the counters are cheap enough to read per call, the
+ * algorithm's ref and evict functions are called through these wrappers,
+ * which count their events, and the replay loop counts the events of each
+ * access.
+ */
+static void (*perf_ref_target)(int, vaddr_t);
+static int (*perf_evict_target)(void);
+
+static void
+perf_ref(int frame, vaddr_t vaddr)
+{
+	perf_begin(PERF_REF);
+	perf_ref_target(frame, vaddr);
+	perf_end(PERF_REF);
+}
+
+static int
+perf_evict(void)
+{
+	perf_begin(PERF_EVICT);
+	int frame = perf_evict_target();
+	perf_end(PERF_EVICT);
+	return frame;
+}
+
+static void
+replay_trace_perf(FILE *f, size_t linenum)
+{
+	replay_trace(f, linenum, perf_ref, true);
+}
+
+static void
+replay_stream_perf(void)
+{
+	replay_stream(perf_ref, true);
+}
+
+/* The algs array gives us a mapping between the name of an eviction
+ * algorithm as given in a command line argument, and the function to
+ * call to select the victim page.
+ *
+ * The list of REPLACEMENT_ALGORITHMS is found in coremap.h
+ * We use the C preprocessor stringizing and concatenation operations to
+ * create a template for the algorithm function structure.
+ * See https://gcc.gnu.org/onlinedocs/cpp/Stringizing.html
+ * and https://gcc.gnu.org/onlinedocs/cpp/Concatenation.html
+ */
+static struct functions algs[] = {
+#define RA(name) \
+	{ #name, name ## _init, name ## _cleanup, name ## _ref, name ## _prefetch, \
+	  name ## _evict, name ## _drop, name ## _exchange, \
+	  name ## _save, name ## _restore, replay_trace_ ## name, replay_stream_ ## name },
+REPLACEMENT_ALGORITHMS
+#undef RA
+};
+static int num_algs = sizeof(algs) / sizeof(algs[0]);
+
+static void (*replay_func)(FILE *, size_t) = NULL;
+static void (*stream_func)(void) = NULL;
+
+/* Physical memory is mapped directly rather than taken from the heap, so
+ * that it can be aligned to, and backed by, huge pages when it is large.
+ * Fresh anonymous memory is already zero-filled.
+ */
+#define HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+
+static size_t physmem_len;
+
+static unsigned char *
+alloc_physmem(size_t len)
+{
+	// Map an extra huge page so that the start can be aligned, then trim
+	physmem_len = (len + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+	size_t maplen = physmem_len + HUGE_PAGE_SIZE;
+	unsigned char *map = mmap(NULL, maplen, PROT_READ | PROT_WRITE,
+	                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		perror("Failed to map physical memory");
+		exit(1);
+	}
+	unsigned char *start = (unsigned char *)
+		(((uintptr_t)map + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+	if (start > map) {
+		munmap(map, start - map);
+	}
+	munmap(start + physmem_len, map + maplen - (start + physmem_len));
+	madvise(start, physmem_len, MADV_HUGEPAGE);
+	return start;
+}
+
+/* Parse the -A option, "first" or "color[:ncolors]". The number of colors
+ * defaults to the number for the last level of cache, and is set once
+ * the caches and page size are known.
+ */
+static int
+parse_frame_policy(char *arg)
+{
+	if (strcmp(arg, "first") == 0) {
+		frame_policy = FRAME_FIRST;
+		return 0;
+	}
+	if (strncmp(arg, "color", 5) != 0) {
+		return -1;
+	}
+	frame_policy = FRAME_COLOR;
+	frame_colors = 0;
+	if (arg[5] == ':') {
+		char *end;
+		frame_colors = strtoul(arg + 6, &end, 10);
+		return (*end == '\0' && frame_colors > 0) ? 0 : -1;
+	}
+	return arg[5] == '\0' ? 0 : -1;
+}
+
+/* Parse the -k option, "interval[,low,high]". The watermarks default to
+ * 1/16 and 1/8 of memory, at least one frame, and are checked once memsize
+ * is known.
+ */
+static int
+parse_cleaner(char *arg)
+{
+	char *end;
+	cleaner_interval = strtoul(arg, &end, 10);
+	if (*end == ',') {
+		cleaner_low = strtoul(end + 1, &end, 10);
+		if (*end != ',') {
+			return -1;
+		}
+		cleaner_high = strtoul(end + 1, &end, 10);
+	}
+	return (*end == '\0' && cleaner_interval > 0) ? 0 : -1;
+}
+
+/* Sharded mode, -N. Before the workers start, the trace is scanned for its
+ * processes, so that each one can be given a fixed share of memory and
+ * swap, and for the groups of processes that share pages, by fork or
+ * attach, which have to be simulated together. Groups are numbered in the
+ * order that their first process appears.
+ */
+static size_t shard_procs_len;
+static int *shard_pids;   // pid of each process, in order of appearance ...
+static int *shard_group;  // ... and its group
+static size_t shard_groups_len;
+
+static size_t
+find_proc(int pid)
+{
+	for (size_t i = 0; i < shard_procs_len; ++i) {
+		if (shard_pids[i] == pid) {
+			return i;
+		}
+	}
+	shard_pids = realloc(shard_pids, (shard_procs_len + 1) * sizeof(int));
+	shard_group = realloc(shard_group, (shard_procs_len + 1) * sizeof(int));
+	shard_pids[shard_procs_len] = pid;
+	shard_group[shard_procs_len] = shard_procs_len; // Alone, for now
+	return shard_procs_len++;
+}
+
+/* While scanning, shard_group links each process to one that it shares
+ * pages with, ending at a process that links to itself.
+ */
+static size_t
+proc_root(size_t i)
+{
+	while ((size_t)shard_group[i] != i) {
+		i = shard_group[i];
+	}
+	return i;
+}
+
+static void
+join_procs(size_t a, size_t b)
+{
+	a = proc_root(a);
+	b = proc_root(b);
+	// The process that appeared first stays the root
+	if (a < b) {
+		shard_group[b] = a;
+	} else {
+		shard_group[a] = b;
+	}
+}
+
+/* Scan the trace for its processes and their groups, and rewind it.
+ * Invalid lines are left for the parser to report.
+ */
+static void
+scan_processes(FILE *f)
+{
+	char line[256];
+	struct trace_rec rec;
+	size_t current = SIZE_MAX; // Records before any 'P' belong to pid 0
+	while (fgets(line, sizeof(line), f)) {
 		if (line[0] == '=') {
 			continue;
 		}
+		if (line[0] == 'P') {
+			if (decode_line(line, &rec) == 0) {
+				current = find_proc(rec.arg_pid);
+			}
+			continue;
+		}
+		if (current == SIZE_MAX) {
+			current = find_proc(0);
+		}
+		if ((line[0] == 'F' || line[0] == 'A') && decode_line(line, &rec) == 0) {
+			join_procs(current, find_proc(rec.arg_pid));
+		}
+	}
+	rewind(f);
+	if (shard_procs_len == 0) {
+		find_proc(0);
+	}
 
-		vaddr_t vaddr;
-		char type;
-		unsigned char val;
-		if (sscanf(line, "%c %zx %hhu", &type, &vaddr, &val) != 3) {
-			fprintf(stderr, "Invalid trace line %zu: %s\n",
-				linenum, line);
-			exit(1);
+	// Number the groups, by their roots
+	for (size_t i = 0; i < shard_procs_len; ++i) {
+		size_t root = proc_root(i);
+		shard_group[i] = (root == i) ? (int)shard_groups_len++ : shard_group[root];
+	}
+}
+
+static int
+group_of(int pid)
+{
+	return shard_group[find_proc(pid)];
+}
+
+/* The part of total, in frames, swap slots or pool bytes, that a group
+ * gets: an equal share of total for each of its processes, or
+ * per_process, if it isn't 0
+ */
+static size_t
+group_share(size_t total, size_t per_process, int group)
+{
+	size_t sum = 0;
+	for (size_t i = 0; i < shard_procs_len; ++i) {
+		if (shard_group[i] == group) {
+			sum += per_process ? per_process :
+			       total / shard_procs_len + (i < total % shard_procs_len);
 		}
-		if (type != 'I' && type != 'L' && type != 'S' && type != 'M') {
-			fprintf(stderr,"Invalid reftype, line %zu: %s\n",
-				linenum, line);
-			exit(1);
+	}
+	return sum;
+}
+
+/* Print the statistics of the simulation, from the globals. Used for a
+ * single simulation, and by run_sharded() after merging its workers'.
+ */
+static void
+print_stats(size_t frames_saved)
+{
+	printf("Hit count: %zu\n", hit_count);
+	printf("Miss count: %zu\n", miss_count);
+	printf("Clean evictions: %zu\n", evict_clean_count);
+	printf("Dirty evictions: %zu\n", evict_dirty_count);
+	printf("Total references: %zu\n", ref_count);
+	printf("Hit rate: %.4f\n", ((double)hit_count / ref_count) * 100.0);
+	printf("Miss rate: %.4f\n", ((double)miss_count / ref_count) * 100.0);
+	printf("Simulated time: %.0f ns\n", simulated_ns);
+	printf("Average memory access time: %.2f ns\n", simulated_ns / ref_count);
+	printf("Swap read syscalls: %zu\n", swap_read_calls);
+	printf("Swap write syscalls: %zu\n", swap_write_calls);
+	if (readahead_window > 0) {
+		printf("Readahead pages: %zu\n", readahead_count);
+		printf("Readahead hits: %zu\n", readahead_hit_count);
+		printf("Readahead hit ratio: %.4f\n", readahead_count ?
+		       ((double)readahead_hit_count / readahead_count) * 100.0 : 0.0);
+	}
+	if (cleaner_interval > 0) {
+		printf("Cleaner runs: %zu\n", cleaner_runs);
+		printf("Pages cleaned: %zu\n", cleaned_count);
+		printf("Cleaned pages evicted clean: %zu\n", cleaned_evict_count);
+		printf("Cleaned pages dirtied again: %zu\n", cleaned_wasted_count);
+		double per_write = cleaned_count ? cleaner_write_time / cleaned_count : 0.0;
+		printf("Fault path swap write time saved: %f (%.9f per write)\n",
+		       per_write * cleaned_evict_count, per_write);
+	}
+	if (zswap_pool_limit > 0) {
+		size_t pageins = zswap_loads + swap_read_calls + swap_wb_hits;
+		printf("Compressed pool hits: %zu\n", zswap_loads);
+		printf("Compressed pool hit rate: %.4f\n", pageins ?
+		       ((double)zswap_loads / pageins) * 100.0 : 0.0);
+		printf("Compressed pool pages: %zu (%zu same-filled, %zu rejected)\n",
+		       zswap_stores, zswap_same_pages, zswap_rejects);
+		printf("Compressed pool occupancy: %zu bytes in %zu pages, peak %zu of %zu bytes\n",
+		       zswap_pool_bytes, zswap_pool_pages, zswap_pool_peak, zswap_pool_limit);
+		printf("Swap pageouts: %zu, written to swapfile: %zu\n",
+		       swap_pageout_count, swap_pages_written);
+	}
+	if (swap_wb_depth > 0) {
+		printf("Swap pageins from writeback queue: %zu\n", swap_wb_hits);
+		printf("Swap writeback stalls: %zu\n", swap_wb_stalls);
+	}
+	if (tlb_entries > 0) {
+		printf("TLB hits: %zu\n", tlb_hit_count);
+		printf("TLB misses: %zu\n", tlb_miss_count);
+		printf("TLB hit rate: %.4f\n",
+		       ((double)tlb_hit_count / ref_count) * 100.0);
+	}
+	if (shared_page_count > 0) {
+		printf("Pages shared by fork or attach: %zu\n", shared_page_count);
+		printf("Copy-on-write faults: %zu\n", cow_fault_count);
+		printf("Frames saved by sharing at end: %zu\n", frames_saved);
+		printf("Eviction fan-out: %.4f mappings per eviction, max %zu\n",
+		       (evict_clean_count + evict_dirty_count) ?
+		       (double)evict_mapping_count / (evict_clean_count + evict_dirty_count) : 0.0,
+		       evict_fanout_max);
+	}
+	if (unmap_page_count > 0) {
+		printf("Pages unmapped: %zu (%zu frames and %zu swap slots freed)\n",
+		       unmap_page_count, unmap_frame_count, unmap_swap_count);
+	}
+	if (frame_policy == FRAME_COLOR) {
+		printf("Frame colors: %zu\n", frame_colors);
+		printf("Frames allocated with the page's color: %zu\n", color_match_count);
+		printf("Frames allocated with another color: %zu\n", color_fallback_count);
+	}
+	if (num_tiers > 0) {
+		printf("Tier scans: %zu\n", tier_scans);
+		for (size_t t = 0; t < num_tiers; ++t) {
+			printf("Tier %zu: %zu frames at %.0f ns, %zu accesses (%.4f%%), "
+			       "%zu promoted in, %zu demoted in\n",
+			       t, tiers[t].frames, tiers[t].ns, tiers[t].accesses,
+			       ((double)tiers[t].accesses / ref_count) * 100.0,
+			       tiers[t].promotions, tiers[t].demotions);
 		}
-		if ((vaddr % PAGE_SIZE) > SIMPAGESIZE) {
-			fprintf(stderr,"Invalid vaddr, offset must be in range of simulated page frame size, line %zu: %s\n",
-				linenum, line);
-			exit(1);
+	}
+	for (int l = 0; l < cache_levels; ++l) {
+		struct cache_stats *cs = &cache_stats[l];
+		size_t misses = cs->compulsory + cs->capacity + cs->conflict;
+		printf("L%d cache hits: %zu\n", l + 1, cs->hits);
+		printf("L%d cache misses: %zu (compulsory %zu, capacity %zu, conflict %zu)\n",
+		       l + 1, misses, cs->compulsory, cs->capacity, cs->conflict);
+		printf("L%d cache hit rate: %.4f\n", l + 1,
+		       cs->hits + misses ? ((double)cs->hits / (cs->hits + misses)) * 100.0 : 0.0);
+	}
+}
+
+static int
+run_sharded(FILE *tfp)
+{
+	double starttime = get_time();
+	char line[256];
+	size_t linenum = 0;
+	struct trace_rec rec;
+	int pid = 0;
+	int group = -1; // Not known until the process has a record
+	while (fgets(line, sizeof(line), tfp)) {
+		++linenum;
+		int ret = decode_line(line, &rec);
+		if (ret > 0) {
+			continue;
 		}
-		if (debug > 1) {			
-			printf("%c %lx %hhu\n", type, vaddr, val);
+		if (ret < 0) {
+			report_invalid(linenum, line, ret);
+			shard_abort();
+			return 1;
 		}
-		
-		access_mem(type, vaddr, val, linenum);
+		if (rec.type == 'P') {
+			pid = rec.arg_pid;
+			group = -1;
+			continue;
+		}
+		if (group < 0) {
+			group = group_of(pid);
+		}
+		rec.linenum = linenum;
+		rec.pid = pid;
+		rec.group = group;
+		shard_push(group % shard_count, &rec);
+	}
+	rec.type = 'E';
+	for (size_t i = 0; i < shard_count; ++i) {
+		shard_push(i, &rec);
+	}
+	fclose(tfp);
+	if (shard_wait() != 0) {
+		return 1;
+	}
+	double endtime = get_time();
+
+	for (size_t i = 0; i < shard_procs_len; ++i) {
+		shard_result(shard_group[i])->processes++;
+	}
+	free(shard_pids);
+	free(shard_group);
+	struct shard_result total = shard_merge();
+	print_stats(total.frames_saved);
+	printf("\n");
+	printf("Processes: %zu\n", total.processes);
+	shard_print_processes();
+	for (size_t i = 0; i < shard_count; ++i) {
+		size_t processes = 0, refs = 0, hits = 0;
+		for (size_t g = i; g < shard_groups_len; g += shard_count) {
+			processes += shard_result(g)->processes;
+			refs += shard_result(g)->ref_count;
+			hits += shard_result(g)->hit_count;
+		}
+		printf("Shard %zu: %zu processes, %zu references, hit rate %.4f\n",
+		       i, processes, refs, refs ? ((double)hits / refs) * 100.0 : 0.0);
+	}
+	printf("Time to run simulation: %f\n", endtime - starttime);
+	printf("References per second: %.0f\n", total.ref_count / (endtime - starttime));
+	if (total.leak_free) {
+		printf("No memory leaks detected.\n");
+	} else {
+		printf("Detected memory leaks in a shard.\n");
 	}
+	return 0;
+}
+
+/* Analysis mode, -T */
+static int
+analyze(const char *tracefile)
+{
+	FILE *tfp = open_trace(tracefile);
+	if (!tfp) {
+		return 1;
+	}
+	init_csc369_malloc(false);
+	long start_mallocs = get_current_num_mallocs();
+	long start_bytes = get_current_bytes_malloced();
+
+	double starttime = get_time();
+	analysis_init();
+	analyze_trace(tfp);
+	double endtime = get_time();
+
+	analysis_report();
+	printf("Time to run analysis: %f\n", endtime - starttime);
+	printf("Memory used by analysis: %ld bytes\n",
+	       get_current_bytes_malloced() - start_bytes);
+	analysis_destroy();
+	fclose(tfp);
+	if (!is_leak_free(start_mallocs, start_bytes)) {
+		printf("Detected memory leaks in analysis.\n");
+	}
+	return 0;
+}
+
+/* Cleanup data structures and remove temporary swapfile */
+static void
+free_simulation(void)
+{
+	cleanup_func();
+	cache_destroy();
+	frame_alloc_destroy();
+	if (num_tiers > 0) {
+		tier_destroy();
+	}
+	free369(coremap);
+	munmap(physmem, physmem_len);
+	swap_destroy(true);
+	free_pagetable();
+	free(config);
+	config = NULL;
 }
 
 void
@@ -133,16 +861,64 @@ usage(char *prog)
 {
 	fprintf(stderr,
 		"USAGE: %s -f tracefile "
-		"-m memorysize -s swapsize -a algorithm [-v num -p]\n", prog);
-	fprintf(stderr, "\t-f tracefile  - path to trace file to simulate\n");
+		"-m memorysize -s swapsize -a algorithm [-g pagesize -d num -p -b backend -u -w depth -R window -z bytes "
+		"-k interval[,low,high] -l -q frames -t entries -i refs -o file -j -c costs "
+		"-x caches -A policy -n tiers -N workers -L lambda -P -K refs -S snapshot -r snapshot]\n", prog);
+	fprintf(stderr, "       %s -f tracefile -T window\n", prog);
+	fprintf(stderr, "\t-f tracefile  - path to trace file to simulate, - for standard input\n");
 	fprintf(stderr, "\t-m memorysize - number of physical memory frames\n");
 	fprintf(stderr, "\t-s swapsize   - number of frames in swapfile\n");
 	fprintf(stderr, "\t-a algorithm  - replacement algorithm to use, one of:\n");
 	for (int i = 0; i < num_algs; ++i) {
 		fprintf(stderr, "\t\t%s\n",algs[i].name);
 	}
+	fprintf(stderr, "\t-g pagesize   - simulated page frame size in bytes, a power\n"
+	                "\t                of 2 up to %d (default %d)\n",
+	        MAX_SIMPAGESIZE, DEFAULT_SIMPAGESIZE);
 	fprintf(stderr, "\t-d num        - debug level for output\n");
 	fprintf(stderr, "\t-p            - print pagetable at end\n"); 
+	fprintf(stderr, "\t-b backend    - swap backend, file (default) or mmap\n");
+	fprintf(stderr, "\t-u            - discard freed swap slots (mmap backend)\n");
+	fprintf(stderr, "\t-w depth      - batch up to depth dirty pages in an\n"
+	                "\t                asynchronous swap writeback queue\n");
+	fprintf(stderr, "\t-z bytes      - keep swapped pages in a compressed pool\n"
+	                "\t                of up to bytes before the swapfile\n");
+	fprintf(stderr, "\t-k interval[,low,high]\n"
+	                "\t              - every interval references, if fewer than low\n"
+	                "\t                frames are clean, write out dirty pages until\n"
+	                "\t                high frames are clean\n");
+	fprintf(stderr, "\t-R window     - cluster swap slots and read ahead up to\n"
+	                "\t                window neighbouring pages on swap-in\n");
+	fprintf(stderr, "\t-l            - local replacement: a process over its quota\n"
+	                "\t                evicts its own pages\n");
+	fprintf(stderr, "\t-q frames     - per-process quota for -l (default: equal share)\n");
+	fprintf(stderr, "\t-t entries    - simulate an ASID-tagged TLB with entries entries\n");
+	fprintf(stderr, "\t-i refs       - write statistics for every refs references\n");
+	fprintf(stderr, "\t-o file       - file for -i statistics (default: stdout)\n");
+	fprintf(stderr, "\t-j            - write -i statistics as JSON lines, not CSV\n");
+	fprintf(stderr, "\t-c costs      - latency model in ns, e.g. hit=100,tlb=30,zero=1000,\n"
+	                "\t                read=80000,write=100000,pool=2000,migrate=2000\n"
+	                "\t                (defaults shown)\n");
+	fprintf(stderr, "\t-x caches     - simulate CPU caches over physical addresses, L1 first,\n"
+	                "\t                e.g. 32k:8:64,256k:8:64:plru (size:ways:line[:lru|plru])\n");
+	fprintf(stderr, "\t-A policy     - free frame allocation, first (default) or\n"
+	                "\t                color[:ncolors], default ncolors from -x\n");
+	fprintf(stderr, "\t-n tiers      - split memory into tiers, fastest first, e.g.\n"
+	                "\t                256:100,*:300,place=first|interleave,scan=1000,max=16\n"
+	                "\t                (frames:ns per tier; * is the rest of memory)\n");
+	fprintf(stderr, "\t-T window     - analyze the trace instead: footprint, working set\n"
+	                "\t                size over windows of window references, reuse\n"
+	                "\t                gaps, reads and writes, hottest pages\n");
+	fprintf(stderr, "\t-N workers    - split the processes in the trace between workers,\n"
+	                "\t                each with an equal share of memory and swap,\n"
+	                "\t                or -q frames of memory\n");
+	fprintf(stderr, "\t-L lambda     - decay rate for lrfu, from 0 (LFU) to 1 (LRU)\n"
+	                "\t                (default 0.001)\n");
+	fprintf(stderr, "\t-P            - count cycles, instructions, LLC and branch misses\n"
+	                "\t                per reference in each phase (slows the simulation)\n");
+	fprintf(stderr, "\t-K refs       - save a snapshot of the simulation every refs references\n");
+	fprintf(stderr, "\t-S snapshot   - file for -K snapshots (default: sim.snapshot)\n");
+	fprintf(stderr, "\t-r snapshot   - resume from snapshot, with the same options\n");
 }
 
 int
@@ -158,8 +934,14 @@ main(int argc, char *argv[])
 	char *replacement_alg = NULL;
 	int opt;
 	bool print_pgtbl = false;
+	char *interval_path = "-";
+	char *resume_path = NULL;
+	char *cache_spec = "";
+	char *tier_spec = "";
+	off_t trace_pos = 0;
+	size_t linenum = 0;
 	
-	while ((opt = getopt(argc, argv, "f:m:a:s:d:ph")) != -1) {
+	while ((opt = getopt(argc, argv, "f:m:a:s:g:d:pb:uw:R:z:k:lq:t:i:o:jc:x:A:n:T:N:L:PK:S:r:h")) != -1) {
 		switch (opt) {
 		case 'f':
 			tracefile = optarg;
@@ -173,12 +955,113 @@ main(int argc, char *argv[])
 		case 's':
 			swapsize = strtoul(optarg, NULL, 10);
 			break;
+		case 'g':
+			simpagesize = strtoul(optarg, NULL, 10);
+			break;
 		case 'd':
 			debug = strtol(optarg, NULL, 10);
 			break;
 		case 'p':
 			print_pgtbl = true;
 			break;
+		case 'b':
+			swap_backend_name = optarg;
+			break;
+		case 'u':
+			swap_discard = true;
+			break;
+		case 'w':
+			swap_wb_depth = strtoul(optarg, NULL, 10);
+			break;
+		case 'R':
+			readahead_window = strtoul(optarg, NULL, 10);
+			break;
+		case 'z':
+			zswap_pool_limit = strtoul(optarg, NULL, 10);
+			break;
+		case 'k':
+			if (parse_cleaner(optarg) != 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'l':
+			local_replacement = true;
+			break;
+		case 'q':
+			local_quota = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			tlb_entries = strtoul(optarg, NULL, 10);
+			break;
+		case 'i':
+			interval_length = strtoul(optarg, NULL, 10);
+			break;
+		case 'o':
+			interval_path = optarg;
+			break;
+		case 'j':
+			interval_json = true;
+			break;
+		case 'c':
+			if (cost_parse(optarg) != 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'x':
+			if (cache_parse(optarg) != 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			cache_spec = optarg;
+			break;
+		case 'A':
+			if (parse_frame_policy(optarg) != 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'n':
+			if (tier_parse(optarg) != 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			tier_spec = optarg;
+			break;
+		case 'T':
+			analysis_window = strtoul(optarg, NULL, 10);
+			if (analysis_window == 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'N':
+			shard_count = strtoul(optarg, NULL, 10);
+			if (shard_count == 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'L':
+			lrfu_lambda = strtod(optarg, NULL);
+			if (lrfu_lambda < 0 || lrfu_lambda > 1) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'P':
+			perf_enabled = true;
+			break;
+		case 'K':
+			snapshot_interval = strtoul(optarg, NULL, 10);
+			break;
+		case 'S':
+			snapshot_path = optarg;
+			break;
+		case 'r':
+			resume_path = optarg;
+			break;
 		case 'h':
 		default:
 			usage(argv[0]);
@@ -186,14 +1069,111 @@ main(int argc, char *argv[])
 		}
 	}
 
+	if (tracefile && analysis_window > 0) {
+		return analyze(tracefile);
+	}
 	if (!tracefile || !memsize || !swapsize || !replacement_alg) {
 		usage(argv[0]);
 		return 1;
 	}
+	if (simpagesize == 0 || simpagesize > MAX_SIMPAGESIZE ||
+	    (simpagesize & (simpagesize - 1)) != 0) {
+		fprintf(stderr, "Error: page size must be a power of 2 up to %d\n",
+		        MAX_SIMPAGESIZE);
+		return 1;
+	}
+	if (frame_policy == FRAME_COLOR && frame_colors == 0) {
+		if (cache_levels == 0) {
+			fprintf(stderr, "Error: -A color needs -x, or a number of colors\n");
+			return 1;
+		}
+		frame_colors = cache_page_colors();
+	}
+	if (num_tiers > 0 && frame_policy == FRAME_COLOR) {
+		fprintf(stderr, "Error: -A color can't be combined with -n\n");
+		return 1;
+	}
+	for (int i = 0; i < num_algs; ++i) {
+		if (strcmp(algs[i].name, replacement_alg) == 0) {
+			init_func = algs[i].init;
+			cleanup_func = algs[i].cleanup;
+			ref_func = algs[i].ref;
+			prefetch_func = algs[i].prefetch;
+			evict_func = algs[i].evict;
+			drop_func = algs[i].drop;
+			exchange_func = algs[i].exchange;
+			save_func = algs[i].save;
+			restore_func = algs[i].restore;
+			replay_func = algs[i].replay;
+			stream_func = algs[i].stream;
+			break;
+		}
+	}
+	if (!evict_func) {
+		fprintf(stderr, "Error: invalid replacement algorithm - %s\n",
+				replacement_alg);
+		return 1;
+	}
+
+	bool streaming = (strcmp(tracefile, "-") == 0);
+	if (streaming && (snapshot_interval > 0 || resume_path)) {
+		fprintf(stderr, "Error: -K and -r need a trace file, not -f -\n");
+		return 1;
+	}
+
+	// In sharded mode, this process becomes the trace parser, and each
+	// group of processes is simulated with its processes' share of memory.
+	int group = -1;
+	if (shard_count > 0) {
+		if (num_tiers > 0 || snapshot_interval > 0 || resume_path ||
+		    interval_length > 0 || print_pgtbl || perf_enabled || streaming) {
+			fprintf(stderr, "Error: -N can't be combined with -n, -K, -r, -i, -p, -P or -f -\n");
+			return 1;
+		}
+		FILE *tfp = open_trace(tracefile);
+		if (!tfp) {
+			return 1;
+		}
+		scan_processes(tfp);
+		if (memsize < shard_procs_len || swapsize < shard_procs_len) {
+			fprintf(stderr, "Error: each of the %zu processes needs at least "
+			        "one frame of memory and swap\n", shard_procs_len);
+			return 1;
+		}
+		if (local_quota * shard_procs_len > memsize) {
+			fprintf(stderr, "Error: -q %zu for each of the %zu processes is "
+			        "more than memorysize\n", local_quota, shard_procs_len);
+			return 1;
+		}
+		group = shard_start(shard_groups_len);
+		if (group < 0) {
+			return run_sharded(tfp);
+		}
+		fclose(tfp);
+		memsize = group_share(memsize, local_quota, group);
+		swapsize = group_share(swapsize, 0, group);
+		zswap_pool_limit = group_share(zswap_pool_limit, 0, group);
+		free(shard_pids);
+		free(shard_group);
+	}
+	if (cleaner_interval > 0 && cleaner_high == 0) {
+		// At least one frame, so that small memories are cleaned too
+		cleaner_low = memsize >= 16 ? memsize / 16 : 1;
+		cleaner_high = memsize >= 8 ? memsize / 8 : 1;
+	}
+	if (cleaner_low > cleaner_high || cleaner_high > memsize) {
+		fprintf(stderr, "Error: cleaner watermarks must satisfy "
+		        "low <= high <= memorysize\n");
+		return 1;
+	}
+	if (!swap_backend_valid(swap_backend_name)) {
+		fprintf(stderr, "Error: invalid swap backend - %s\n",
+		        swap_backend_name);
+		return 1;
+	}
 	
-	FILE *tfp = fopen(tracefile, "r");
-	if (!tfp) {
-		perror(tracefile);
+	FILE *tfp = NULL;
+	if (group < 0 && !(tfp = open_trace(tracefile))) {
 		return 1;
 	}
 
@@ -203,68 +1183,121 @@ main(int argc, char *argv[])
 	init_csc369_malloc(false);
 	coremap = malloc369(memsize * sizeof(struct frame));
 	memset(coremap, 0, memsize*sizeof(struct frame));
-	physmem = malloc369(memsize * SIMPAGESIZE);
-	memset(physmem, 0, memsize*SIMPAGESIZE);
-	swap_init(swapsize);
+	if (num_tiers > 0 && tier_init() != 0) {
+		fprintf(stderr, "Error: tiers must add up to memorysize frames\n");
+		return 1;
+	}
+	physmem = alloc_physmem(memsize * simpagesize);
 	install_fatal_handlers();
+	swap_init(swapsize);
 	
 	// Get initial memory use after initializing main simulation data structures.
 	start_mallocs = get_current_num_mallocs();
 	start_bytes = get_current_bytes_malloced();
 
-	for (int i = 0; i < num_algs; ++i) {
-		if (strcmp(algs[i].name, replacement_alg) == 0) {
-			init_func = algs[i].init;
-			cleanup_func = algs[i].cleanup;
-			ref_func = algs[i].ref;
-			evict_func = algs[i].evict;
-			break;
-		}
+	if (interval_length > 0 && interval_open(interval_path, resume_path != NULL) != 0) {
+		return 1;
 	}
-	if (!evict_func) {
-		fprintf(stderr, "Error: invalid replacement algorithm - %s\n",
-				replacement_alg);
+	// Doubles are printed exactly, so that any change is caught
+	if (asprintf(&config, "-m %zu -g %zu -s %zu -a %s -b %s -w %zu -R %zu "
+	             "-z %zu -k %zu,%zu,%zu -l %d -q %zu -t %zu -i %zu -x %s -A %d:%zu -n %s -L %.17g "
+	             "-c hit=%.17g,tlb=%.17g,zero=%.17g,read=%.17g,write=%.17g,pool=%.17g,migrate=%.17g",
+	             memsize, simpagesize, swapsize, replacement_alg, swap_backend_name,
+	             swap_wb_depth, readahead_window, zswap_pool_limit,
+	             cleaner_interval, cleaner_low, cleaner_high, local_replacement,
+	             local_quota, tlb_entries, interval_length, cache_spec,
+	             frame_policy, frame_colors, tier_spec, lrfu_lambda,
+	             cost_model.hit, cost_model.tlb_miss, cost_model.zero_fill,
+	             cost_model.swap_read, cost_model.swap_write, cost_model.pool,
+	             cost_model.migrate) < 0) {
+		perror("Failed to build the configuration string");
 		return 1;
 	}
 
 	// Timed section of code starts here. This includes:
 	//     - initialization of the pagetable
 	//     - initialization of the replacement algorithm
+	//     - restoring the snapshot, when resuming
 	//     - replaying the trace
+	if (perf_enabled) {
+		perf_init();
+		if (perf_per_call) {
+			perf_ref_target = ref_func;
+			ref_func = perf_ref;
+			perf_evict_target = evict_func;
+			evict_func = perf_evict;
+			replay_func = replay_trace_perf;
+			stream_func = replay_stream_perf;
+		}
+	}
 	starttime = get_time();
+	if (perf_enabled) {
+		perf_begin(PERF_INIT);
+	}
 	init_pagetable(); /* pagetable initialization */
 	init_func();      /* replacement algorithm initialization */
-	replay_trace(tfp);
+	cache_init();
+	frame_alloc_init();
+	if (resume_path) {
+		snapshot_restore(resume_path, config, &trace_pos, &linenum);
+		if (fseek(tfp, trace_pos, SEEK_SET) != 0) {
+			perror(tracefile);
+			return 1;
+		}
+	}
+	if (perf_enabled) {
+		perf_end(PERF_INIT);
+		perf_begin(PERF_REPLAY);
+	}
+	if (group >= 0) {
+		replay_shard(group);
+	} else if (streaming) {
+		stream_start(tfp, decode_line, exit_invalid);
+		stream_func();    /* replay_stream() for the algorithm */
+		stream_stop();
+	} else {
+		replay_func(tfp, linenum); /* replay_trace() for the algorithm */
+	}
+	swap_flush();     /* wait for queued swap writes to complete */
+	if (perf_enabled) {
+		perf_end(PERF_REPLAY);
+	}
 	endtime = get_time();
 	// End of timed section of code.
 
+	if (group >= 0) {
+		// The parser prints the results of all of the groups
+		shard_report(group);
+		free_simulation();
+		shard_result(group)->leak_free = is_leak_free(start_mallocs, start_bytes);
+		shard_result(group)->done = true;
+		return 0;
+	}
+
+	if (interval_length > 0) {
+		interval_close();
+	}
+
 	// Get final memory use.
 	bytes_used = get_current_bytes_malloced() - start_bytes;
 	
-	// Print statistics.
-	printf("Hit count: %zu\n", hit_count);
-	printf("Miss count: %zu\n", miss_count);
-	printf("Clean evictions: %zu\n", evict_clean_count);
-	printf("Dirty evictions: %zu\n", evict_dirty_count);
-	printf("Total references: %zu\n", ref_count);
-	printf("Hit rate: %.4f\n", ((double)hit_count / ref_count) * 100.0);
-	printf("Miss rate: %.4f\n", ((double)miss_count / ref_count) * 100.0);
+	print_stats(pages_saved_by_sharing());
+	print_process_stats();
 
 	printf("Time to run simulation: %f\n",endtime - starttime);
+	printf("References per second: %.0f\n", ref_count / (endtime - starttime));
 	printf("Memory used by simulation: %ld bytes\n", bytes_used);
+	if (perf_enabled) {
+		perf_report(ref_count);
+		perf_destroy();
+	}
 
 	if (print_pgtbl) {
 		print_pagetable();
 	}
 	
-	cleanup_func();
-
-	// Cleanup data structures and remove temporary swapfile
 	fclose(tfp);
-	free369(coremap);
-	free369(physmem);
-	swap_destroy(true);
-	free_pagetable();
+	free_simulation();
 
 	// Check for memory leaks
 	if (is_leak_free(start_mallocs, start_bytes)) {
@@ -300,6 +1333,26 @@ fatal_signal_handler(int signum, siginfo_t *info, void *context)
 	exit(signum);
 }
 
+/* A sharded worker is stopped with SIGTERM when the run is aborted, or
+ * when the parser dies. That isn't an error of the worker's own.
+ */
+static void
+term_signal_handler(int signum)
+{
+	(void)signum;
+	swap_destroy(false);
+	_exit(1);
+}
+
+/* An exit() on an error, like a trace line that the page tables reject,
+ * removes the swapfile too. A run that finishes has removed it already.
+ */
+static void
+remove_swapfile(void)
+{
+	swap_destroy(false);
+}
+
 static void
 install_fatal_handlers()
 {
@@ -319,4 +1372,11 @@ install_fatal_handlers()
 	sigaction(SIGTRAP, &sig_action, &old_action);
 	sigaction(SIGILL, &sig_action, &old_action);
 	sigaction(SIGFPE, &sig_action, &old_action);
+
+	memset(&sig_action, 0, sizeof(sig_action));
+	sig_action.sa_handler = term_signal_handler;
+	sigemptyset(&sig_action.sa_mask);
+	sigaction(SIGTERM, &sig_action, &old_action);
+
+	atexit(remove_swapfile);
 }
@@ -1,11 +1,16 @@
 #ifndef __SIM_H__
 #define __SIM_H__
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
 #include "timer.h"
 
 typedef unsigned long vaddr_t; /* virtual address is 48 bits, need long type */
 
-#define SIMPAGESIZE 16         /* Simulated physical memory page frame size */
+#define DEFAULT_SIMPAGESIZE 16 /* Default simulated page frame size */
+#define MAX_SIMPAGESIZE 4096   /* Frames can't be larger than a trace page */
+extern size_t simpagesize;     /* Simulated physical memory page frame size */
 extern unsigned char *physmem; /* Array of bytes to simulate physical memory */
 extern size_t memsize;         /* Number of frames of physical memory */
 extern int debug;              /* Control amount of debugging output */
@@ -16,6 +21,15 @@ extern void init_pagetable(void);
 extern void print_pagetable(void);
 extern void free_pagetable(void);
 extern unsigned char *find_physpage(vaddr_t vaddr, char type);
+extern void switch_process(int pid);
+extern void fork_process(int child_pid);
+extern void exit_process(void);
+extern int attach_pages(int src_pid, vaddr_t vaddr, size_t npages);
+extern int unmap_pages(vaddr_t vaddr, size_t npages);
+extern size_t pages_saved_by_sharing(void);
+extern void print_process_stats(void);
+extern void print_process_lines(FILE *f);
+extern size_t resident_pages(void);
 
 
 /* Counters for paging-related events. Set in pagetable.c, reported by sim.c */
@@ -24,9 +38,37 @@ extern size_t miss_count;
 extern size_t ref_count;
 extern size_t evict_clean_count;
 extern size_t evict_dirty_count;
+extern size_t dirty_frame_count; /* resident pages that are dirty */
+extern size_t shared_page_count; /* mappings created by fork or attach */
+extern size_t cow_fault_count;   /* writes that copied a shared page */
+extern size_t unmap_page_count;  /* page table entries removed by unmaps */
+extern size_t unmap_frame_count; /* frames freed by unmaps */
+extern size_t unmap_swap_count;  /* swap slots freed by unmaps */
+extern size_t evict_mapping_count; /* mappings invalidated by evictions */
+extern size_t evict_fanout_max;  /* most mappings invalidated at once */
 
-/* Pointers to per-eviction algorithm functions needed in pagetable.c */
+/* Replacement scope, set by sim.c. With local replacement, a process that
+ * holds at least local_quota frames (or an equal share of memory, if
+ * local_quota is 0) must evict one of its own pages.
+ */
+extern bool local_replacement;
+extern size_t local_quota;
+
+/* Swap readahead window in pages (0 disables it), set by sim.c, and
+ * readahead counters, set in pagetable.c and reported by sim.c
+ */
+extern size_t readahead_window;
+extern size_t readahead_count;
+extern size_t readahead_hit_count;
+
+/* Pointers to per-eviction algorithm functions needed in pagetable.c
+ * and snapshot.c */
 extern void (*ref_func)(int frame, vaddr_t vaddr);
+extern void (*prefetch_func)(int frame, vaddr_t vaddr);
 extern int (*evict_func)(void);
+extern void (*drop_func)(int frame);
+extern void (*exchange_func)(int a, int b);
+extern void (*save_func)(void);
+extern void (*restore_func)(void);
 
 #endif /* __SIM_H__ */
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "malloc369.h"
+#include "sim.h"
+#include "coremap.h"
+#include "zswap.h"
+#include "tlb.h"
+#include "cache.h"
+#include "tier.h"
+#include "cost.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC "SIMSNAP2"
+
+size_t snapshot_interval = 0;
+const char *snapshot_path = "sim.snapshot";
+
+static FILE *snap_file;
+static const char *snap_name; // For error messages
+
+void snap_write(const void *data, size_t len)
+{
+	if (len > 0 && fwrite(data, len, 1, snap_file) != 1) {
+		perror(snap_name);
+		exit(1);
+	}
+}
+
+void snap_read(void *data, size_t len)
+{
+	if (len > 0 && fread(data, len, 1, snap_file) != 1) {
+		fprintf(stderr, "%s: snapshot is truncated\n", snap_name);
+		exit(1);
+	}
+}
+
+/* The snapshot is written to a temporary file first and then renamed, so
+ * that a run killed in the middle of a checkpoint leaves the previous
+ * snapshot intact.
+ */
+void snapshot_save(const char *config, off_t trace_pos, size_t linenum)
+{
+	char tmp_path[strlen(snapshot_path) + 5];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", snapshot_path);
+	snap_name = tmp_path;
+	if (!(snap_file = fopen(tmp_path, "w"))) {
+		perror(tmp_path);
+		exit(1);
+	}
+
+	size_t config_len = strlen(config);
+	snap_write(SNAPSHOT_MAGIC, strlen(SNAPSHOT_MAGIC));
+	SNAP_WRITE(config_len);
+	snap_write(config, config_len);
+	SNAP_WRITE(trace_pos);
+	SNAP_WRITE(linenum);
+	snap_write(physmem, memsize * simpagesize);
+	SNAP_WRITE(simulated_ns);
+
+	pagetable_save();
+	save_func();
+	frame_alloc_save();
+	if (num_tiers > 0) {
+		tier_save();
+	}
+	swap_save();
+	if (tlb_entries > 0) {
+		tlb_save();
+	}
+	cache_save();
+	cleaner_save();
+	interval_save();
+
+	if (fclose(snap_file) != 0) {
+		perror(tmp_path);
+		exit(1);
+	}
+	if (rename(tmp_path, snapshot_path) != 0) {
+		perror(snapshot_path);
+		exit(1);
+	}
+}
+
+void snapshot_restore(const char *path, const char *config,
+                      off_t *trace_pos, size_t *linenum)
+{
+	snap_name = path;
+	if (!(snap_file = fopen(path, "r"))) {
+		perror(path);
+		exit(1);
+	}
+
+	char magic[strlen(SNAPSHOT_MAGIC)];
+	size_t config_len;
+	snap_read(magic, sizeof(magic));
+	if (memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0) {
+		fprintf(stderr, "%s: not a snapshot\n", path);
+		exit(1);
+	}
+	SNAP_READ(config_len);
+	char *saved = malloc369(config_len + 1);
+	snap_read(saved, config_len);
+	saved[config_len] = '\0';
+	if (strcmp(saved, config) != 0) {
+		fprintf(stderr, "%s: snapshot was taken with different options:\n"
+		        "\tsnapshot: %s\n\tthis run: %s\n", path, saved, config);
+		exit(1);
+	}
+	free369(saved);
+	SNAP_READ(*trace_pos);
+	SNAP_READ(*linenum);
+	snap_read(physmem, memsize * simpagesize);
+	SNAP_READ(simulated_ns);
+
+	pagetable_restore();
+	restore_func();
+	frame_alloc_restore();
+	if (num_tiers > 0) {
+		tier_restore();
+	}
+	swap_restore();
+	if (tlb_entries > 0) {
+		tlb_restore();
+	}
+	cache_restore();
+	cleaner_restore();
+	interval_restore();
+
+	// Anything left over means the snapshot does not match this build
+	if (fgetc(snap_file) != EOF) {
+		fprintf(stderr, "%s: unexpected data at end of snapshot\n", path);
+		exit(1);
+	}
+	fclose(snap_file);
+}
@@ -0,0 +1,68 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "sim.h"
+
+// Checkpoint and resume. Every snapshot_interval references, sim writes its
+// full state to a snapshot file: page tables, coremap, physmem, swap
+// contents and bitmap, replacement policy state, counters, and the position
+// in the trace. A run started with -r picks up exactly where the snapshot
+// was taken, and ends with the same counters as a run that was never
+// interrupted.
+//
+// Each module saves and restores its own state with snap_write() and
+// snap_read(), in the same order. Snapshots are only meant to be read by
+// the same build of sim, with the same options.
+
+// Configuration, set by sim.c. An interval of 0 disables checkpoints.
+extern size_t snapshot_interval;
+extern const char *snapshot_path;
+
+// Write a snapshot to snapshot_path. trace_pos and linenum give the
+// position in the trace after the last reference that was replayed.
+// 'config' describes the options that the state depends on; it must match
+// when the snapshot is restored.
+extern void snapshot_save(const char *config, off_t trace_pos, size_t linenum);
+
+// Restore the snapshot in 'path', after everything has been initialized as
+// usual. Sets *trace_pos and *linenum to where replay should continue.
+// Exits with an error message if the snapshot can't be used.
+extern void snapshot_restore(const char *path, const char *config,
+                             off_t *trace_pos, size_t *linenum);
+
+// Save or restore len bytes at data, for use by the modules.
+extern void snap_write(const void *data, size_t len);
+extern void snap_read(void *data, size_t len);
+#define SNAP_WRITE(var) snap_write(&(var), sizeof(var))
+#define SNAP_READ(var) snap_read(&(var), sizeof(var))
+
+// Module state, in the order it appears in the snapshot. The replacement
+// algorithm's state comes right after the page tables, through save_func
+// and restore_func.
+extern void pagetable_save(void);
+extern void pagetable_restore(void);
+extern void frame_alloc_save(void);
+extern void frame_alloc_restore(void);
+extern void tier_save(void);
+extern void tier_restore(void);
+extern void swap_save(void);
+extern void swap_restore(void);
+extern void zswap_save(void);
+extern void zswap_restore(void);
+extern void tlb_save(void);
+extern void tlb_restore(void);
+extern void cache_save(void);
+extern void cache_restore(void);
+extern void cleaner_save(void);
+extern void cleaner_restore(void);
+extern void interval_save(void);
+extern void interval_restore(void);
+
+// Returns the restored page table entry for vpn in address space asid, or
+// NULL if there is none. Used to rebuild pointers to entries.
+extern struct pt_entry_s *pagetable_entry(unsigned int asid, vaddr_t vpn);
+
+#endif /* __SNAPSHOT_H__ */
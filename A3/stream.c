@@ -0,0 +1,131 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stream.h"
+
+#define BATCH_SIZE 1024 // Records per batch
+
+enum batch_status { BATCH_MORE, BATCH_END, BATCH_ERROR };
+
+struct batch {
+	struct trace_rec recs[BATCH_SIZE];
+	size_t len;
+	bool full;                // Filled by the parser, not yet handed back
+	enum batch_status status; // Whether the trace goes on after this batch
+	size_t error_linenum;
+	int error;
+	char error_line[256];
+};
+
+static struct batch batches[2];
+static int current = -1; // Batch the simulation has, or -1 for none yet
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static pthread_t parser;
+static FILE *stream_file;
+static decode_func stream_decode;
+static invalid_func stream_invalid;
+
+static void *parse(void *arg)
+{
+	(void)arg;
+	size_t linenum = 0;
+	for (int b = 0; ; b ^= 1) {
+		struct batch *batch = &batches[b];
+		pthread_mutex_lock(&lock);
+		while (batch->full) {
+			pthread_cond_wait(&changed, &lock);
+		}
+		pthread_mutex_unlock(&lock);
+
+		// Comments don't take a slot, so a batch is only short at the end
+		batch->len = 0;
+		batch->status = BATCH_MORE;
+		while (batch->len < BATCH_SIZE) {
+			// Only this thread reads the file, so skip stdio's locking
+			if (!fgets_unlocked(batch->error_line, sizeof(batch->error_line),
+			                    stream_file)) {
+				batch->status = BATCH_END;
+				break;
+			}
+			++linenum;
+			struct trace_rec *rec = &batch->recs[batch->len];
+			int ret = stream_decode(batch->error_line, rec);
+			if (ret < 0) {
+				batch->status = BATCH_ERROR;
+				batch->error_linenum = linenum;
+				batch->error = ret;
+				break;
+			}
+			if (ret == 0) {
+				rec->linenum = linenum;
+				batch->len++;
+			}
+		}
+
+		pthread_mutex_lock(&lock);
+		batch->full = true;
+		pthread_cond_broadcast(&changed);
+		pthread_mutex_unlock(&lock);
+		if (batch->status != BATCH_MORE) {
+			return NULL;
+		}
+	}
+}
+
+void stream_start(FILE *f, decode_func decode, invalid_func invalid)
+{
+	stream_file = f;
+	stream_decode = decode;
+	stream_invalid = invalid;
+	current = -1;
+	batches[0].full = false;
+	batches[1].full = false;
+	if (pthread_create(&parser, NULL, parse, NULL) != 0) {
+		perror("pthread_create");
+		exit(1);
+	}
+}
+
+void stream_stop(void)
+{
+	pthread_join(parser, NULL);
+}
+
+// Called once the records of a batch that ended the trace have been taken
+static size_t finish(struct batch *batch)
+{
+	if (batch->status == BATCH_ERROR) {
+		stream_invalid(batch->error_linenum, batch->error_line, batch->error);
+		exit(1);
+	}
+	return 0;
+}
+
+size_t stream_batch(struct trace_rec **recs)
+{
+	if (current >= 0) {
+		struct batch *done = &batches[current];
+		if (done->status != BATCH_MORE) {
+			return finish(done);
+		}
+		pthread_mutex_lock(&lock);
+		done->full = false;
+		pthread_cond_broadcast(&changed);
+		pthread_mutex_unlock(&lock);
+	}
+	current = (current + 1) % 2;
+
+	struct batch *batch = &batches[current];
+	pthread_mutex_lock(&lock);
+	while (!batch->full) {
+		pthread_cond_wait(&changed, &lock);
+	}
+	pthread_mutex_unlock(&lock);
+	if (batch->len == 0) {
+		return finish(batch);
+	}
+	*recs = batch->recs;
+	return batch->len;
+}
@@ -0,0 +1,46 @@
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include <stddef.h>
+#include <stdio.h>
+#include "sim.h"
+
+// Pipelined trace input, for traces read from a pipe (-f -). A parser
+// thread reads and decodes the trace into batches of records, while the
+// simulation consumes the previous batch. There are two batches, so the
+// parser can run at most one batch ahead.
+
+// A decoded trace record. For references, type is I, L, S or M. For 'P',
+// arg_pid is the process switched to; for 'F', the child; for 'A',
+// arg_pid is the process whose pages are attached, and arg is the number
+// of pages. pid and group are only used by sharded mode, where 'E' marks
+// the end of the trace.
+struct trace_rec {
+	vaddr_t vaddr;
+	size_t arg;
+	size_t linenum;
+	int pid;
+	int group;
+	int arg_pid;
+	char type;
+	unsigned char val;
+};
+
+// Decode a trace line into rec. Returns 0 for a record, 1 for a line to
+// skip, and a negative error code if the line is invalid.
+typedef int (*decode_func)(const char *line, struct trace_rec *rec);
+
+// Report an invalid line, given decode_func's error code, and exit.
+typedef void (*invalid_func)(size_t linenum, const char *line, int err);
+
+// Start the parser thread on f, and wait for it to finish.
+extern void stream_start(FILE *f, decode_func decode, invalid_func invalid);
+extern void stream_stop(void);
+
+// Take the next batch of records, handing the last one back to the parser.
+// Returns the number of records, or 0 at the end of the trace. An invalid
+// line ends the simulation with an error, once the records before it have
+// been taken.
+extern size_t stream_batch(struct trace_rec **recs);
+
+#endif /* __STREAM_H__ */
@@ -1,13 +1,18 @@
 #include <assert.h>
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include "malloc369.h"
 #include "sim.h"
 #include "swap.h"
+#include "zswap.h"
+#include "snapshot.h"
 
 //---------------------------------------------------------------------
 // Bitmap definitions and functions to manage space in swapfile.
@@ -15,6 +20,13 @@
 // on demand with a little effort.
 //
 // The bitmap code is modified from the OS/161 bitmap functions.
+//
+// To avoid scanning the whole bitmap on every allocation, we keep a second,
+// summary level: bit i of summary word j is set when bitmap word
+// (j * bits_per_word + i) still has at least one free bit. Both levels are
+// searched with count-trailing-zeros instead of bit-by-bit loops.
+// Allocation is next-fit: the search starts just after the most recently
+// allocated bit, so consecutive page-outs get adjacent slots.
 
 static const size_t bits_per_word = sizeof(size_t) * CHAR_BIT;
 static const size_t word_all_bits = (size_t)-1;
@@ -27,18 +39,40 @@ static size_t nwords_for_nbits(size_t nbits)
 struct bitmap {
 	size_t nbits;
 	size_t *words;
+	size_t *summary;  // One bit per word, set if word is not full
+	size_t hint;      // Bit index to start the next search at
 };
 
+static inline size_t ctz(size_t word)
+{
+	return __builtin_ctzl(word);
+}
+
+// Update the summary bit for bitmap word idx.
+static inline void bitmap_summarize(struct bitmap *b, size_t idx)
+{
+	size_t mask = (size_t)1 << (idx % bits_per_word);
+	if (b->words[idx] == word_all_bits) {
+		b->summary[idx / bits_per_word] &= ~mask;
+	} else {
+		b->summary[idx / bits_per_word] |= mask;
+	}
+}
+
 static int bitmap_init(struct bitmap *b, size_t nbits)
 {
 	size_t nwords = nwords_for_nbits(nbits);
+	size_t nsummary = nwords_for_nbits(nwords);
 	b->words = malloc369(nwords * sizeof(size_t));
-	if (!b->words) {
+	b->summary = malloc369(nsummary * sizeof(size_t));
+	if (!b->words || !b->summary) {
 		return -1;
 	}
 
 	memset(b->words, 0, nwords * sizeof(size_t));
+	memset(b->summary, 0, nsummary * sizeof(size_t));
 	b->nbits = nbits;
+	b->hint = 0;
 
 	// Mark any leftover bits at the end in use
 	if (nwords > nbits / bits_per_word) {
@@ -53,43 +87,488 @@ static int bitmap_init(struct bitmap *b, size_t nbits)
 		}
 	}
 
+	for (size_t idx = 0; idx < nwords; ++idx) {
+		bitmap_summarize(b, idx);
+	}
+
 	return 0;
 }
 
+// Find the first word at or after word 'start' that has a free bit,
+// ignoring any free bits in word 'start' that are below bit 'startbit'.
+// Returns the bit index of the free bit, or b->nbits if there is none.
+static size_t bitmap_search(struct bitmap *b, size_t start, size_t startbit)
+{
+	size_t nwords = nwords_for_nbits(b->nbits);
+	size_t nsummary = nwords_for_nbits(nwords);
+
+	// Free bits in the starting word itself, at or above startbit
+	if (start < nwords) {
+		size_t avail = ~b->words[start] & (word_all_bits << startbit);
+		if (avail != 0) {
+			return start * bits_per_word + ctz(avail);
+		}
+		++start;
+	}
+
+	// Otherwise, find the next non-full word using the summary
+	size_t sidx = start / bits_per_word;
+	if (sidx >= nsummary) {
+		return b->nbits;
+	}
+	size_t nonfull = b->summary[sidx] & (word_all_bits << (start % bits_per_word));
+	while (nonfull == 0) {
+		if (++sidx == nsummary) {
+			return b->nbits;
+		}
+		nonfull = b->summary[sidx];
+	}
+	size_t idx = sidx * bits_per_word + ctz(nonfull);
+	return idx * bits_per_word + ctz(~b->words[idx]);
+}
+
 static int bitmap_alloc(struct bitmap *b, size_t *index)
 {
-	size_t max_idx = nwords_for_nbits(b->nbits);
+	size_t hint = b->hint < b->nbits ? b->hint : 0;
+	size_t bit = bitmap_search(b, hint / bits_per_word, hint % bits_per_word);
+	if (bit >= b->nbits && hint != 0) {
+		// Wrap around to the start of the bitmap
+		bit = bitmap_search(b, 0, 0);
+	}
+	if (bit >= b->nbits) {
+		return -1;
+	}
+
+	size_t idx = bit / bits_per_word;
+	b->words[idx] |= (size_t)1 << (bit % bits_per_word);
+	bitmap_summarize(b, idx);
+	b->hint = bit + 1;
+	*index = bit;
+	return 0;
+}
 
-	for (size_t idx = 0; idx < max_idx; ++idx) {
-		if (b->words[idx] != word_all_bits) {
-			for (size_t offset = 0; offset < bits_per_word; ++offset) {
-				size_t mask = (size_t)1 << offset;
+// Allocate the specific bit 'index', if it is free. The next-fit search
+// continues from just after it.
+static int bitmap_alloc_at(struct bitmap *b, size_t index)
+{
+	size_t idx = index / bits_per_word;
+	size_t mask = (size_t)1 << (index % bits_per_word);
+	if (index >= b->nbits || (b->words[idx] & mask)) {
+		return -1;
+	}
+	b->words[idx] |= mask;
+	bitmap_summarize(b, idx);
+	b->hint = index + 1;
+	return 0;
+}
 
-				if ((b->words[idx] & mask) == 0) {
-					b->words[idx] |= mask;
-					*index = (idx * bits_per_word) + offset;
-					assert(*index < b->nbits);
-					return 0;
-				}
+static void bitmap_free(struct bitmap *b, size_t index)
+{
+	assert(index < b->nbits);
+	size_t idx = index / bits_per_word;
+	size_t mask = (size_t)1 << (index % bits_per_word);
+	assert(b->words[idx] & mask);
+	b->words[idx] &= ~mask;
+	bitmap_summarize(b, idx);
+}
+
+// Returns true if no bit in [index, index + count) is allocated.
+static bool bitmap_range_free(struct bitmap *b, size_t index, size_t count)
+{
+	for (size_t bit = index; bit < index + count; ) {
+		size_t idx = bit / bits_per_word;
+		size_t offset = bit % bits_per_word;
+		if (offset == 0 && bit + bits_per_word <= index + count) {
+			if (b->words[idx] != 0) {
+				return false;
 			}
-			assert(false);
+			bit += bits_per_word;
+		} else {
+			if (b->words[idx] & ((size_t)1 << offset)) {
+				return false;
+			}
+			++bit;
 		}
 	}
-	return -1;
+	return true;
 }
 
 static void bitmap_destroy(struct bitmap *b)
 {
 	free369(b->words);
+	free369(b->summary);
+}
+
+//---------------------------------------------------------------------
+// Swap backends.
+//
+// The swap area is a temporary file. The "file" backend accesses it with
+// pread/pwrite, one system call per page (or per run of adjacent pages
+// when flushing the writeback queue). The "mmap" backend makes the file
+// sparse, maps it into the address space and moves pages with memcpy, so
+// there are no per-page system calls and swap contents still stay out of
+// the simulator's heap.
+
+struct swap_backend {
+	const char *name;
+	void (*init)(size_t nslots);
+	void (*destroy)(void);
+	ssize_t (*readv)(const struct iovec *iov, int iovcnt, off_t offset);
+	ssize_t (*writev)(const struct iovec *iov, int iovcnt, off_t offset);
+	void (*discard)(off_t offset, size_t len); // may be NULL
+};
+
+const char *swap_backend_name = "file";
+bool swap_discard = false;
+size_t swap_read_calls = 0;
+size_t swap_write_calls = 0;
+
+static int swapfd = -1; // -1 until swap_init() creates the swapfile
+static unsigned char *swapmem;  // Mapped swap area for mmap backend
+static size_t swapmem_len;
+
+static void file_init(size_t nslots)
+{
+	(void)nslots;
+}
+
+static void file_destroy(void)
+{
+}
+
+static ssize_t file_readv(const struct iovec *iov, int iovcnt, off_t offset)
+{
+	++swap_read_calls;
+	return preadv(swapfd, iov, iovcnt, offset);
+}
+
+static ssize_t file_writev(const struct iovec *iov, int iovcnt, off_t offset)
+{
+	++swap_write_calls;
+	return pwritev(swapfd, iov, iovcnt, offset);
+}
+
+static void mmap_init(size_t nslots)
+{
+	swapmem_len = nslots * simpagesize;
+	if (ftruncate(swapfd, swapmem_len) != 0) {
+		perror("Failed to size swapfile");
+		exit(1);
+	}
+	swapmem = mmap(NULL, swapmem_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+	               swapfd, 0);
+	if (swapmem == MAP_FAILED) {
+		perror("Failed to map swapfile");
+		exit(1);
+	}
+}
+
+static void mmap_destroy(void)
+{
+	munmap(swapmem, swapmem_len);
+}
+
+static ssize_t mmap_readv(const struct iovec *iov, int iovcnt, off_t offset)
+{
+	size_t len = 0;
+	for (int i = 0; i < iovcnt; ++i) {
+		memcpy(iov[i].iov_base, &swapmem[offset + len], iov[i].iov_len);
+		len += iov[i].iov_len;
+	}
+	return len;
+}
+
+static ssize_t mmap_writev(const struct iovec *iov, int iovcnt, off_t offset)
+{
+	size_t len = 0;
+	for (int i = 0; i < iovcnt; ++i) {
+		memcpy(&swapmem[offset + len], iov[i].iov_base, iov[i].iov_len);
+		len += iov[i].iov_len;
+	}
+	return len;
+}
+
+// Drop the pages of the mapping that lie entirely within the byte range,
+// so that the kernel can reclaim them.
+static void mmap_discard(off_t offset, size_t len)
+{
+	size_t pgsize = sysconf(_SC_PAGESIZE);
+	size_t start = (offset + pgsize - 1) / pgsize * pgsize;
+	size_t end = (offset + len) / pgsize * pgsize;
+	if (start < end) {
+		madvise(&swapmem[start], end - start, MADV_DONTNEED);
+	}
+}
+
+static const struct swap_backend backends[] = {
+	{ "file", file_init, file_destroy, file_readv, file_writev, NULL },
+	{ "mmap", mmap_init, mmap_destroy, mmap_readv, mmap_writev, mmap_discard },
+};
+static const int num_backends = sizeof(backends) / sizeof(backends[0]);
+static const struct swap_backend *backend;
+
+// Returns true if 'name' is one of the swap backends.
+bool swap_backend_valid(const char *name)
+{
+	for (int i = 0; i < num_backends; ++i) {
+		if (strcmp(backends[i].name, name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+//---------------------------------------------------------------------
+// Writeback queue definitions and functions.
+//
+// When enabled (swap_wb_depth > 0), dirty pages written by swap_pageout are
+// copied into an in-memory batch instead of being written immediately. Once
+// the batch fills up, it is handed to a background flusher thread, which
+// sorts the pages by swap offset and writes runs of adjacent slots with a
+// single write. We keep two batches: the one being filled by the
+// simulation and the one being flushed. The simulation only ever writes to
+// the filling batch, and the flusher only ever reads the flushing batch, so
+// swap_pagein can look up pages in both without holding the lock.
+
+struct wb_batch {
+	size_t count;           // Number of pages currently in the batch
+	off_t *offsets;         // Swap offset of each page
+	unsigned char *data;    // Page contents, simpagesize bytes per page
+	long *slot_index;       // Index in batch for each swap slot, or -1
+};
+
+size_t swap_wb_depth = 0;
+size_t swap_wb_hits = 0;
+size_t swap_wb_stalls = 0;
+
+static struct wb_batch wb_batches[2];
+static struct wb_batch *wb_filling;
+static struct wb_batch *wb_flushing;
+static size_t *wb_order;        // Scratch space for sorting flushing batch
+static struct iovec *wb_iov;    // Scratch space for building backend writes
+static pthread_t wb_thread;
+static pthread_mutex_t wb_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wb_cond = PTHREAD_COND_INITIALIZER;
+static bool wb_pending;         // true while flushing batch is being written
+static bool wb_stop;            // true when flusher thread should exit
+static bool wb_running;         // true if flusher thread was started
+
+// Look for the page at 'offset' in batch b. Returns the index of the
+// page in the batch, or -1 if it is not there.
+static inline long wb_find(struct wb_batch *b, off_t offset)
+{
+	return b->slot_index[offset / simpagesize];
+}
+
+// Empty batch b so that it can be filled again.
+static void wb_clear(struct wb_batch *b)
+{
+	for (size_t i = 0; i < b->count; ++i) {
+		b->slot_index[b->offsets[i] / simpagesize] = -1;
+	}
+	b->count = 0;
+}
+
+static int wb_compare(const void *a, const void *b)
+{
+	off_t oa = wb_flushing->offsets[*(const size_t *)a];
+	off_t ob = wb_flushing->offsets[*(const size_t *)b];
+	return (oa > ob) - (oa < ob);
+}
+
+// Write out every page in the flushing batch, coalescing pages in
+// adjacent swap slots into a single backend write.
+static void wb_write_batch(struct wb_batch *b)
+{
+	for (size_t i = 0; i < b->count; ++i) {
+		wb_order[i] = i;
+	}
+	qsort(wb_order, b->count, sizeof(size_t), wb_compare);
+
+	size_t i = 0;
+	while (i < b->count) {
+		off_t start = b->offsets[wb_order[i]];
+		int iovcnt = 0;
+		size_t len = 0;
+		while (i < b->count && iovcnt < IOV_MAX &&
+		       b->offsets[wb_order[i]] == start + (off_t)len) {
+			wb_iov[iovcnt].iov_base = &b->data[wb_order[i] * simpagesize];
+			wb_iov[iovcnt].iov_len = simpagesize;
+			len += simpagesize;
+			++iovcnt;
+			++i;
+		}
+
+		ssize_t bytes_written = backend->writev(wb_iov, iovcnt, start);
+		if (bytes_written != (ssize_t)len) {
+			fprintf(stderr, "swap writeback: did not write whole run\n");
+		}
+	}
+}
+
+static void *wb_flusher(void *arg)
+{
+	(void)arg;
+	pthread_mutex_lock(&wb_lock);
+	while (true) {
+		while (!wb_pending && !wb_stop) {
+			pthread_cond_wait(&wb_cond, &wb_lock);
+		}
+		if (!wb_pending) {
+			break;
+		}
+		pthread_mutex_unlock(&wb_lock);
+
+		wb_write_batch(wb_flushing);
+
+		pthread_mutex_lock(&wb_lock);
+		wb_pending = false;
+		pthread_cond_broadcast(&wb_cond);
+	}
+	pthread_mutex_unlock(&wb_lock);
+	return NULL;
+}
+
+// Wait until the flusher is idle. Must be called with wb_lock held.
+static void wb_wait_idle(void)
+{
+	while (wb_pending) {
+		pthread_cond_wait(&wb_cond, &wb_lock);
+	}
+}
+
+// Hand the filling batch to the flusher thread and start filling the
+// other one. Waits for the previous flush to complete first, since its
+// batch is about to be reused.
+static void wb_submit(void)
+{
+	pthread_mutex_lock(&wb_lock);
+	if (wb_pending) {
+		++swap_wb_stalls;
+		wb_wait_idle();
+	}
+	struct wb_batch *tmp = wb_flushing;
+	wb_flushing = wb_filling;
+	wb_filling = tmp;
+	wb_clear(wb_filling);
+	wb_pending = true;
+	pthread_cond_broadcast(&wb_cond);
+	pthread_mutex_unlock(&wb_lock);
+}
+
+static void wb_init(size_t nslots)
+{
+	for (int i = 0; i < 2; ++i) {
+		wb_batches[i].count = 0;
+		wb_batches[i].offsets = malloc369(swap_wb_depth * sizeof(off_t));
+		wb_batches[i].data = malloc369(swap_wb_depth * simpagesize);
+		wb_batches[i].slot_index = malloc369(nslots * sizeof(long));
+		memset(wb_batches[i].slot_index, 0xff, nslots * sizeof(long));
+	}
+	wb_order = malloc369(swap_wb_depth * sizeof(size_t));
+	wb_iov = malloc369(IOV_MAX * sizeof(struct iovec));
+	wb_filling = &wb_batches[0];
+	wb_flushing = &wb_batches[1];
+	wb_pending = false;
+	wb_stop = false;
+
+	if (pthread_create(&wb_thread, NULL, wb_flusher, NULL) != 0) {
+		fprintf(stderr, "Failed to start swap writeback thread\n");
+		exit(1);
+	}
+	wb_running = true;
+}
+
+static void wb_destroy(void)
+{
+	pthread_mutex_lock(&wb_lock);
+	wb_stop = true;
+	pthread_cond_broadcast(&wb_cond);
+	pthread_mutex_unlock(&wb_lock);
+	pthread_join(wb_thread, NULL);
+	wb_running = false;
+
+	for (int i = 0; i < 2; ++i) {
+		free369(wb_batches[i].offsets);
+		free369(wb_batches[i].data);
+		free369(wb_batches[i].slot_index);
+	}
+	free369(wb_order);
+	free369(wb_iov);
+}
+
+// Write out everything still sitting in the writeback queue, and wait for
+// the writes to complete.
+void swap_flush(void)
+{
+	if (!wb_running) {
+		return;
+	}
+	if (wb_filling->count > 0) {
+		wb_submit();
+	}
+	pthread_mutex_lock(&wb_lock);
+	wb_wait_idle();
+	pthread_mutex_unlock(&wb_lock);
 }
 
 //---------------------------------------------------------------------
 // Swap definitions and functions.
 
-static int swapfd;
+size_t swap_pageout_count = 0;
+size_t swap_pages_written = 0;
+size_t swap_slots_used = 0;
+
 static struct bitmap swapmap;
 static char fname[20];
 
+// Write the page 'data' to 'offset' in the swap file, or queue it for
+// writeback if the writeback queue is enabled.
+// Return: 0 on success, -1 on failure
+static int swap_write(off_t offset, const void *data)
+{
+	++swap_pages_written;
+
+	// Queue the page for writeback. A page that is already in the filling
+	// batch is just overwritten with the newer contents.
+	if (wb_running) {
+		long idx = wb_find(wb_filling, offset);
+		if (idx == -1) {
+			idx = wb_filling->count++;
+			wb_filling->offsets[idx] = offset;
+			wb_filling->slot_index[offset / simpagesize] = idx;
+		}
+		memcpy(&wb_filling->data[idx * simpagesize], data, simpagesize);
+		if (wb_filling->count == swap_wb_depth) {
+			wb_submit();
+		}
+		return 0;
+	}
+
+	// Write page data from memory into swapfile
+	struct iovec iov = { (void *)data, simpagesize };
+	ssize_t bytes_written = backend->writev(&iov, 1, offset);
+	if (bytes_written != (ssize_t)simpagesize) {
+		if (bytes_written == -1) {
+			perror("swap_pageout: failed to write page");
+		} else {
+			fprintf(stderr, "swap_pageout: did not write whole page\n");
+		}
+		return -1;
+	}
+	return 0;
+}
+
+// Where the pages the compressed pool evicted during a swap_pageout went
+static unsigned spill_place;
+
+// Called by the compressed pool to write out pages it evicts.
+static void zswap_spill(off_t offset, const void *data)
+{
+	spill_place |= wb_running ? SWAP_QUEUE : SWAP_DEVICE;
+	swap_write(offset, data);
+}
+
 void swap_init(size_t size)
 {
 	// Initialize the swap file
@@ -99,23 +578,61 @@ void swap_init(size_t size)
 		exit(1);
 	}
 
+	// Set up the swap backend
+	for (int i = 0; i < num_backends; ++i) {
+		if (strcmp(backends[i].name, swap_backend_name) == 0) {
+			backend = &backends[i];
+		}
+	}
+	if (!backend) {
+		fprintf(stderr, "Invalid swap backend - %s\n", swap_backend_name);
+		exit(1);
+	}
+	backend->init(size);
+
 	// Initialize the bitmap
 	if (bitmap_init(&swapmap, size) != 0) {
 		perror("Failed to create bitmap for swap\n");
 		exit(1);
 	}
+
+	// Start the writeback queue, if requested
+	if (swap_wb_depth > 0) {
+		wb_init(size);
+	}
+
+	// Set up the compressed pool, if requested
+	if (zswap_pool_limit > 0) {
+		zswap_init(size, zswap_spill);
+	}
 }
 
 void swap_destroy(bool free_bitmap)
 {
+	// We might call swap_destroy from signal handler, to clean up
+	// temporary swapfile when process exits. If so, it is not
+	// safe to call free(), and any memory leaks don't matter since
+	// process will be exiting anyway. The flusher thread will go away
+	// with the process too. The handler can run before the swapfile
+	// exists, or after it is gone.
+	if (swapfd < 0) {
+		return;
+	}
+	if (free_bitmap && wb_running) {
+		wb_destroy();
+	}
+	if (free_bitmap && zswap_pool_limit > 0) {
+		zswap_destroy();
+	}
+
 	// Close and remove swapfile
+	if (free_bitmap) {
+		backend->destroy();
+	}
 	close(swapfd);
 	unlink(fname);
+	swapfd = -1;
 
-	// We might call swap_destroy from signal handler, to clean up
-	// temporary swapfile when process exits. If so, it is not
-	// safe to call free(), and any memory leaks don't matter since
-	// process will be exiting anyway.
 	if (free_bitmap) {
 		// Destroy bitmap
 		bitmap_destroy(&swapmap);
@@ -126,42 +643,123 @@ void swap_destroy(bool free_bitmap)
 // in swap file.
 // Input:  frame - the physical frame number (not byte offset) in physmem
 //         offset - the byte position in the swap file
+//         place - set to where the page was found
 // Return: 0 on success,
 //         -errno on error or number of bytes read on partial read
 //
-int swap_pagein(unsigned int frame, off_t offset)
+int swap_pagein(unsigned int frame, off_t offset, unsigned *place)
 {
 	assert(offset != INVALID_SWAP);
 
 	// Get pointer to page data in (simulated) physical memory
-	void *frame_ptr = &physmem[frame * SIMPAGESIZE];
+	void *frame_ptr = &physmem[frame * simpagesize];
 
-	// Seek to position in swap file where this page was stored
-	off_t pos = lseek(swapfd, offset, SEEK_SET);
-	if (pos != offset) {
-		assert(pos == (off_t)-1);
-		perror("swap_pagein: failed to set read position");
-		return -errno;
+	// Check the compressed pool first, since it always has the newest copy
+	if (zswap_pool_limit > 0 && zswap_load(offset, frame_ptr)) {
+		*place = SWAP_POOL;
+		return 0;
+	}
+
+	// If the page has not been written back yet, copy it from the queue.
+	// The filling batch holds the most recent copy, so check it first.
+	if (wb_running) {
+		long idx;
+		*place = SWAP_QUEUE;
+		if ((idx = wb_find(wb_filling, offset)) != -1) {
+			memcpy(frame_ptr, &wb_filling->data[idx * simpagesize], simpagesize);
+			++swap_wb_hits;
+			return 0;
+		}
+		if ((idx = wb_find(wb_flushing, offset)) != -1) {
+			memcpy(frame_ptr, &wb_flushing->data[idx * simpagesize], simpagesize);
+			++swap_wb_hits;
+			return 0;
+		}
 	}
 
 	// Read page data from swapfile into memory
-	ssize_t bytes_read = read(swapfd, frame_ptr, SIMPAGESIZE);
-	if (bytes_read != SIMPAGESIZE) {
+	*place = SWAP_DEVICE;
+	struct iovec iov = { frame_ptr, simpagesize };
+	ssize_t bytes_read = backend->readv(&iov, 1, offset);
+	if (bytes_read != (ssize_t)simpagesize) {
+		if (bytes_read == -1) {
+			perror("swap_pagein: failed to read page");
+			return -errno;
+		}
 		fprintf(stderr, "swap_pagein: did not read whole page\n");
 		return bytes_read;
 	}
 	return 0;
 }
 
+// Read 'n' pages stored in consecutive slots starting at 'offset' in the
+// swap file into the (simulated) physical memory frames in 'frames', with
+// a single read from the backend.
+// Input:  frames - the physical frame numbers, one per page
+//         n - the number of pages
+//         offset - the byte position in the swap file of the first page
+//         place - set to SWAP_DEVICE, plus SWAP_POOL if any page came
+//                 from the compressed pool
+// Return: 0 on success,
+//         -errno on error or number of bytes read on partial read
+//
+int swap_pagein_batch(unsigned int *frames, int n, off_t offset, unsigned *place)
+{
+	assert(offset != INVALID_SWAP);
+	assert(n > 0 && n <= IOV_MAX);
+
+	struct iovec iov[n];
+	for (int i = 0; i < n; ++i) {
+		iov[i].iov_base = &physmem[frames[i] * simpagesize];
+		iov[i].iov_len = simpagesize;
+	}
+	ssize_t bytes_read = backend->readv(iov, n, offset);
+	*place = SWAP_DEVICE;
+	if (bytes_read == -1) {
+		perror("swap_pagein_batch: failed to read pages");
+		return -errno;
+	}
+
+	// Pages still in the compressed pool or writeback queue may be stale in
+	// the swap file, or lie past its current end, so patch them up. The
+	// pool holds the newest copy, then the filling batch of the queue.
+	for (int i = 0; i < n; ++i) {
+		off_t pos = offset + i * simpagesize;
+		long idx = -1;
+		if (zswap_pool_limit > 0 && zswap_load(pos, iov[i].iov_base)) {
+			*place |= SWAP_POOL;
+			continue;
+		}
+		if (wb_running) {
+			if ((idx = wb_find(wb_filling, pos)) != -1) {
+				memcpy(iov[i].iov_base, &wb_filling->data[idx * simpagesize], simpagesize);
+			} else if ((idx = wb_find(wb_flushing, pos)) != -1) {
+				memcpy(iov[i].iov_base, &wb_flushing->data[idx * simpagesize], simpagesize);
+			}
+		}
+		if (idx == -1 && bytes_read < (ssize_t)((i + 1) * simpagesize)) {
+			fprintf(stderr, "swap_pagein_batch: did not read all pages\n");
+			return bytes_read;
+		}
+	}
+	return 0;
+}
+
 // Write data from (simulated) physical memory 'frame' to 'offset'
 // in swap file. Allocates space in swap file for virtual page if needed.
 // Input:  frame - the physical frame number (not byte offset in physmem)
 //         offset - the byte position in the swap file
+//         place - set to the places written, may be NULL
 // Return: the offset where the data was written on success,
 //         or INVALID_SWAP on failure
 //
-off_t swap_pageout(unsigned int frame, off_t offset)
+off_t swap_pageout(unsigned int frame, off_t offset, unsigned *place)
 {
+	unsigned dummy;
+	if (place == NULL) {
+		place = &dummy;
+	}
+
 	// Check if swap has already been allocated for this page
 	if (offset == INVALID_SWAP) {
 		size_t idx;
@@ -170,26 +768,185 @@ off_t swap_pageout(unsigned int frame, off_t offset)
 			                "Try running again with a larger swapsize.\n");
 			return INVALID_SWAP;
 		}
-		offset = idx * SIMPAGESIZE;
+		offset = idx * simpagesize;
+		++swap_slots_used;
 	}
 	assert(offset != INVALID_SWAP);
 
 	// Get pointer to page data in (simulated) physical memory
-	void *frame_ptr = &physmem[frame * SIMPAGESIZE];
+	void *frame_ptr = &physmem[frame * simpagesize];
+	++swap_pageout_count;
+
+	// Keep the page in the compressed pool if it compresses
+	spill_place = 0;
+	if (zswap_pool_limit > 0 && zswap_store(offset, frame_ptr)) {
+		*place = SWAP_POOL | spill_place;
+		return offset;
+	}
 
-	// Seek to position in swap file where this page will be stored
-	off_t pos = lseek(swapfd, offset, SEEK_SET);
-	if (pos != offset) {
-		assert(pos == (off_t)-1);
-		perror("swap_pageout: failed to set write position");
+	*place = spill_place | (wb_running ? SWAP_QUEUE : SWAP_DEVICE);
+	if (swap_write(offset, frame_ptr) != 0) {
 		return INVALID_SWAP;
 	}
+	return offset;
+}
 
-	// Read page data from swapfile into memory
-	ssize_t bytes_written = write(swapfd, frame_ptr, SIMPAGESIZE);
-	if (bytes_written != SIMPAGESIZE) {
-		fprintf(stderr, "swap_pageout: did not write whole page\n");
+// Allocate the swap slot at 'offset' for a page that is about to be
+// paged out, so that pages can be clustered in the swap file.
+// Return: offset on success, or INVALID_SWAP if that slot is in use or
+//         outside the swap file.
+off_t swap_reserve(off_t offset)
+{
+	if (offset < 0 || bitmap_alloc_at(&swapmap, offset / simpagesize) != 0) {
 		return INVALID_SWAP;
 	}
+	++swap_slots_used;
 	return offset;
 }
+
+// Release the swap slot at 'offset', because the page stored there is no
+// longer needed. With swap_discard set, the backend is also told to drop
+// the storage behind it once every slot sharing its OS page is free.
+void swap_free(off_t offset)
+{
+	assert(offset != INVALID_SWAP);
+	size_t idx = offset / simpagesize;
+	bitmap_free(&swapmap, idx);
+	--swap_slots_used;
+	if (zswap_pool_limit > 0) {
+		zswap_invalidate(offset);
+	}
+
+	if (swap_discard && backend->discard) {
+		size_t slots = sysconf(_SC_PAGESIZE) / simpagesize;
+		if (slots <= 1) {
+			backend->discard(offset, simpagesize);
+		} else {
+			size_t first = idx / slots * slots;
+			if (first + slots <= swapmap.nbits &&
+			    bitmap_range_free(&swapmap, first, slots)) {
+				backend->discard(first * simpagesize, slots * simpagesize);
+			}
+		}
+	}
+}
+
+//---------------------------------------------------------------------
+// Snapshots.
+//
+// The contents of every allocated slot are read back from the swap file
+// and saved, along with the writeback batches and the compressed pool,
+// which may hold newer copies. The reads and writes made for the snapshot
+// are left out of the syscall counters.
+
+static void wb_save_batch(struct wb_batch *b)
+{
+	SNAP_WRITE(b->count);
+	snap_write(b->offsets, b->count * sizeof(off_t));
+	snap_write(b->data, b->count * simpagesize);
+}
+
+static void wb_restore_batch(struct wb_batch *b)
+{
+	wb_clear(b);
+	SNAP_READ(b->count);
+	snap_read(b->offsets, b->count * sizeof(off_t));
+	snap_read(b->data, b->count * simpagesize);
+	for (size_t i = 0; i < b->count; ++i) {
+		b->slot_index[b->offsets[i] / simpagesize] = i;
+	}
+}
+
+static inline bool slot_in_use(size_t index)
+{
+	return swapmap.words[index / bits_per_word] & ((size_t)1 << (index % bits_per_word));
+}
+
+void swap_save(void)
+{
+	// Let the flusher finish, so the swap file is up to date with the
+	// flushing batch
+	if (wb_running) {
+		pthread_mutex_lock(&wb_lock);
+		wb_wait_idle();
+		pthread_mutex_unlock(&wb_lock);
+	}
+
+	size_t read_calls = swap_read_calls;
+	SNAP_WRITE(swap_read_calls);
+	SNAP_WRITE(swap_write_calls);
+	SNAP_WRITE(swap_pageout_count);
+	SNAP_WRITE(swap_pages_written);
+	SNAP_WRITE(swap_slots_used);
+	SNAP_WRITE(swap_wb_hits);
+	SNAP_WRITE(swap_wb_stalls);
+	snap_write(swapmap.words, nwords_for_nbits(swapmap.nbits) * sizeof(size_t));
+	SNAP_WRITE(swapmap.hint);
+
+	// Slots that were allocated but never written may lie past the end
+	// of the file, so save however much could be read
+	unsigned char page[simpagesize];
+	for (size_t i = 0; i < swapmap.nbits; ++i) {
+		if (!slot_in_use(i)) {
+			continue;
+		}
+		struct iovec iov = { page, simpagesize };
+		ssize_t len = backend->readv(&iov, 1, i * simpagesize);
+		if (len < 0) {
+			len = 0;
+		}
+		SNAP_WRITE(len);
+		snap_write(page, len);
+	}
+	swap_read_calls = read_calls;
+
+	if (wb_running) {
+		wb_save_batch(wb_filling);
+		wb_save_batch(wb_flushing);
+	}
+	if (zswap_pool_limit > 0) {
+		zswap_save();
+	}
+}
+
+void swap_restore(void)
+{
+	size_t write_calls;
+	SNAP_READ(swap_read_calls);
+	SNAP_READ(write_calls);
+	SNAP_READ(swap_pageout_count);
+	SNAP_READ(swap_pages_written);
+	SNAP_READ(swap_slots_used);
+	SNAP_READ(swap_wb_hits);
+	SNAP_READ(swap_wb_stalls);
+	size_t nwords = nwords_for_nbits(swapmap.nbits);
+	snap_read(swapmap.words, nwords * sizeof(size_t));
+	SNAP_READ(swapmap.hint);
+	for (size_t idx = 0; idx < nwords; ++idx) {
+		bitmap_summarize(&swapmap, idx);
+	}
+
+	unsigned char page[simpagesize];
+	for (size_t i = 0; i < swapmap.nbits; ++i) {
+		if (!slot_in_use(i)) {
+			continue;
+		}
+		ssize_t len;
+		SNAP_READ(len);
+		snap_read(page, len);
+		struct iovec iov = { page, len };
+		if (len > 0 && backend->writev(&iov, 1, i * simpagesize) != len) {
+			perror("swap_restore: failed to write page");
+			exit(1);
+		}
+	}
+	swap_write_calls = write_calls;
+
+	if (wb_running) {
+		wb_restore_batch(wb_filling);
+		wb_restore_batch(wb_flushing);
+	}
+	if (zswap_pool_limit > 0) {
+		zswap_restore();
+	}
+}
@@ -1,29 +1,89 @@
 #ifndef __SWAP_H__
 #define __SWAP_H__
 
+#include <stdbool.h>
 #include <sys/types.h>
 
 #define INVALID_SWAP (off_t)-1
 
+// Name of the swap backend to use, "file" (pread/pwrite on a swapfile) or
+// "mmap" (memcpy to a mapped swapfile). Must be set before swap_init().
+extern const char *swap_backend_name;
+extern bool swap_backend_valid(const char *name);
+
+// If true, the backend drops storage for swap slots once they are freed
+// (MADV_DONTNEED for the mmap backend). Must be set before swap_init().
+extern bool swap_discard;
+
+// Number of pages batched in the writeback queue before they are handed to
+// the background flusher thread. 0 means pages are written synchronously.
+// Must be set before calling swap_init().
+extern size_t swap_wb_depth;
+
+// Counters for swap I/O. Set in swap.c, reported by sim.c
+extern size_t swap_read_calls;  // read system calls on the swapfile
+extern size_t swap_write_calls; // write system calls on the swapfile
+extern size_t swap_wb_hits;     // pageins served from the writeback queue
+extern size_t swap_wb_stalls;   // times a full queue waited for the flusher
+extern size_t swap_pageout_count; // calls to swap_pageout
+extern size_t swap_pages_written; // pages written (or queued) to swapfile
+extern size_t swap_slots_used;    // swap slots currently allocated
+
+// Where swap_pagein found a page, or where swap_pageout put it, so that
+// only real I/O is charged the device costs. A pageout can touch more than
+// one place, when storing a page in the compressed pool pushes another out.
+enum swap_place {
+	SWAP_DEVICE = 1, // Read from or written to the swapfile, synchronously
+	SWAP_POOL = 2,   // The compressed pool (-z)
+	SWAP_QUEUE = 4,  // The writeback queue (-w), written to the swapfile later
+};
+
 // Swap functions for use in other files
 extern void swap_init(size_t size);
 extern void swap_destroy(bool free_bitmap);
 
+// Write out any pages still in the writeback queue and wait for them.
+extern void swap_flush(void);
+
 // Read data into (simulated) physical memory 'frame' from 'offset'
 // in swap file.
 // Input:  frame - the physical frame number (not byte offset) in physmem
 //         offset - the byte position in the swap file
+//         place - set to where the page was found
 // Return: 0 on success,
 //         -errno on error or number of bytes read on partial read
-extern int swap_pagein(unsigned int frame, off_t offset);
+extern int swap_pagein(unsigned int frame, off_t offset, unsigned *place);
+
+// Read 'n' pages from consecutive slots starting at 'offset' in swap file
+// into (simulated) physical memory frames, with a single read.
+// Input:  frames - the physical frame numbers, one per page
+//         n - the number of pages
+//         offset - the byte position in the swap file of the first page
+//         place - set to SWAP_DEVICE, plus SWAP_POOL if any page came
+//                 from the compressed pool
+// Return: 0 on success,
+//         -errno on error or number of bytes read on partial read
+extern int swap_pagein_batch(unsigned int *frames, int n, off_t offset,
+                             unsigned *place);
 
 // Write data from (simulated) physical memory 'frame' to 'offset'
 // in swap file. Allocates space in swap file for virtual page if needed.
 // Input:  frame - the physical frame number (not byte offset in physmem)
 //         offset - the byte position in the swap file
+//         place - set to the places written, may be NULL
 // Return: the offset where the data was written on success,
 //         or INVALID_SWAP on failure
-extern off_t swap_pageout(unsigned int frame, off_t offset);
+extern off_t swap_pageout(unsigned int frame, off_t offset, unsigned *place);
+
+// Allocate the specific slot at 'offset' in swap file, so that a page can
+// be placed next to its neighbours.
+// Return: offset on success, or INVALID_SWAP if the slot is not available
+extern off_t swap_reserve(off_t offset);
+
+// Release the space in the swap file at 'offset', when the page stored
+// there is no longer needed.
+// Input:  offset - the byte position in the swap file
+extern void swap_free(off_t offset);
 
 
 #endif /* __SWAP_H__ */
@@ -0,0 +1,286 @@
+#include <stdlib.h>
+#include <string.h>
+#include "malloc369.h"
+#include "sim.h"
+#include "coremap.h"
+#include "cost.h"
+#include "tier.h"
+#include "snapshot.h"
+
+#define HOT  0x3 // Accessed in both of the last two scans
+#define COLD 0x0 // Accessed in neither
+
+size_t num_tiers = 0;
+struct tier tiers[MAX_TIERS];
+bool tier_interleave = false;
+size_t tier_scan_interval = 1000;
+size_t tier_migrate_max = 16;
+size_t tier_scans = 0;
+
+static bool rest_of_memory; // The last tier's size was given as *
+static size_t next_tier;    // For interleave
+static size_t tier_countdown;
+static unsigned char *accessed; // Per frame, set by every reference
+static unsigned char *history;  // Per frame, accessed bits of recent scans
+
+int tier_parse(const char *spec)
+{
+	num_tiers = 0;
+	rest_of_memory = false;
+	while (*spec) {
+		char *end;
+		if (strncmp(spec, "place=", 6) == 0) {
+			spec += 6;
+			end = (char *)spec + strcspn(spec, ",");
+			if (end - spec == 5 && strncmp(spec, "first", 5) == 0) {
+				tier_interleave = false;
+			} else if (end - spec == 10 && strncmp(spec, "interleave", 10) == 0) {
+				tier_interleave = true;
+			} else {
+				return -1;
+			}
+		} else if (strncmp(spec, "scan=", 5) == 0) {
+			tier_scan_interval = strtoul(spec + 5, &end, 10);
+		} else if (strncmp(spec, "max=", 4) == 0) {
+			tier_migrate_max = strtoul(spec + 4, &end, 10);
+		} else {
+			if (num_tiers == MAX_TIERS || rest_of_memory) {
+				return -1;
+			}
+			struct tier *t = &tiers[num_tiers++];
+			memset(t, 0, sizeof(*t));
+			if (*spec == '*') {
+				rest_of_memory = true;
+				end = (char *)spec + 1;
+			} else {
+				t->frames = strtoul(spec, &end, 10);
+				if (end == spec || t->frames == 0) {
+					return -1;
+				}
+			}
+			if (*end != ':') {
+				return -1;
+			}
+			spec = end + 1;
+			t->ns = strtod(spec, &end);
+			if (end == spec || t->ns < 0) {
+				return -1;
+			}
+		}
+		if (*end != ',' && *end != '\0') {
+			return -1;
+		}
+		spec = (*end == ',') ? end + 1 : end;
+	}
+	return num_tiers > 0 ? 0 : -1;
+}
+
+int tier_init(void)
+{
+	size_t first = 0;
+	for (size_t i = 0; i < num_tiers; ++i) {
+		if (rest_of_memory && i == num_tiers - 1) {
+			if (first >= memsize) {
+				return -1;
+			}
+			tiers[i].frames = memsize - first;
+		}
+		tiers[i].first = first;
+		tiers[i].free = tiers[i].frames;
+		first += tiers[i].frames;
+	}
+	if (first != memsize) {
+		return -1;
+	}
+	next_tier = 0;
+	tier_countdown = 0;
+	accessed = malloc369(memsize);
+	memset(accessed, 0, memsize);
+	history = malloc369(memsize);
+	memset(history, 0, memsize);
+	return 0;
+}
+
+void tier_destroy(void)
+{
+	free369(accessed);
+	free369(history);
+}
+
+static size_t frame_tier(size_t frame)
+{
+	size_t t = 0;
+	while (frame >= tiers[t].first + tiers[t].frames) {
+		++t;
+	}
+	return t;
+}
+
+// Returns the lowest free frame in tier t, or -1 if it is full
+static int free_in_tier(size_t t)
+{
+	if (tiers[t].free == 0) {
+		return -1;
+	}
+	for (size_t f = tiers[t].first; f < tiers[t].first + tiers[t].frames; ++f) {
+		if (!coremap[f].in_use) {
+			return f;
+		}
+	}
+	return -1;
+}
+
+// Returns a cold page in tier t that can be moved, or -1 if there is none.
+// Like the clock hand, the search starts where the last one left off.
+static int cold_in_tier(size_t t)
+{
+	struct tier *tier = &tiers[t];
+	for (size_t scanned = 0; scanned < tier->frames; ++scanned) {
+		size_t f = tier->first + tier->hand;
+		tier->hand = (tier->hand + 1) % tier->frames;
+		if (coremap[f].in_use && !coremap[f].pinned &&
+		    (history[f] & HOT) == COLD) {
+			return f;
+		}
+	}
+	return -1;
+}
+
+int tier_alloc(void)
+{
+	for (size_t i = 0; i < num_tiers; ++i) {
+		size_t t = tier_interleave ? (next_tier + i) % num_tiers : i;
+		int frame = free_in_tier(t);
+		if (frame >= 0) {
+			next_tier = (t + 1) % num_tiers;
+			tiers[t].free--;
+			return frame;
+		}
+	}
+	assert(false);
+	return -1;
+}
+
+void tier_placed(int frame)
+{
+	accessed[frame] = 0;
+	history[frame] = 0;
+}
+
+void tier_free(int frame)
+{
+	tiers[frame_tier(frame)].free++;
+}
+
+// Move the page in frame 'from' to frame 'to', and whatever page is in
+// 'to' the other way, keeping their accessed bits with them.
+static void migrate(int from, int to)
+{
+	size_t from_tier = frame_tier(from);
+	size_t to_tier = frame_tier(to);
+	if (to_tier < from_tier) {
+		tiers[to_tier].promotions++;
+	} else {
+		tiers[to_tier].demotions++;
+	}
+	simulated_ns += cost_model.migrate;
+	if (coremap[to].in_use) {
+		// The page in 'to' goes the other way
+		if (from_tier < to_tier) {
+			tiers[from_tier].promotions++;
+		} else {
+			tiers[from_tier].demotions++;
+		}
+		simulated_ns += cost_model.migrate;
+	} else {
+		tiers[to_tier].free--;
+		tiers[from_tier].free++;
+	}
+
+	exchange_frames(from, to);
+	unsigned char tmp = accessed[from];
+	accessed[from] = accessed[to];
+	accessed[to] = tmp;
+	tmp = history[from];
+	history[from] = history[to];
+	history[to] = tmp;
+}
+
+static void tier_scan(void)
+{
+	++tier_scans;
+	for (size_t f = 0; f < memsize; ++f) {
+		history[f] = (history[f] << 1) | accessed[f];
+		accessed[f] = 0;
+	}
+
+	size_t budget = tier_migrate_max;
+	for (size_t t = 1; t < num_tiers && budget > 0; ++t) {
+		for (size_t f = tiers[t].first;
+		     f < tiers[t].first + tiers[t].frames && budget > 0; ++f) {
+			if (!coremap[f].in_use || coremap[f].pinned ||
+			    (history[f] & HOT) != HOT) {
+				continue;
+			}
+			int to = free_in_tier(t - 1);
+			if (to < 0 && (to = cold_in_tier(t - 1)) < 0) {
+				break;
+			}
+			migrate(f, to);
+			--budget;
+		}
+	}
+
+	for (size_t t = 0; t + 1 < num_tiers && budget > 0; ++t) {
+		while (tiers[t].free == 0 && tiers[t + 1].free > 0 && budget > 0) {
+			int from = cold_in_tier(t);
+			if (from < 0) {
+				break;
+			}
+			migrate(from, free_in_tier(t + 1));
+			--budget;
+		}
+	}
+}
+
+void tier_tick(void)
+{
+	if (num_tiers == 0 || tier_scan_interval == 0 ||
+	    ++tier_countdown < tier_scan_interval) {
+		return;
+	}
+	tier_countdown = 0;
+	tier_scan();
+}
+
+void tier_access(int frame)
+{
+	struct tier *t = &tiers[frame_tier(frame)];
+	t->accesses++;
+	simulated_ns += t->ns;
+	accessed[frame] = 1;
+}
+
+void tier_save(void)
+{
+	for (size_t i = 0; i < num_tiers; ++i) {
+		SNAP_WRITE(tiers[i]);
+	}
+	SNAP_WRITE(next_tier);
+	SNAP_WRITE(tier_countdown);
+	SNAP_WRITE(tier_scans);
+	snap_write(accessed, memsize);
+	snap_write(history, memsize);
+}
+
+void tier_restore(void)
+{
+	for (size_t i = 0; i < num_tiers; ++i) {
+		SNAP_READ(tiers[i]);
+	}
+	SNAP_READ(next_tier);
+	SNAP_READ(tier_countdown);
+	SNAP_READ(tier_scans);
+	snap_read(accessed, memsize);
+	snap_read(history, memsize);
+}
@@ -0,0 +1,67 @@
+#ifndef __TIER_H__
+#define __TIER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Memory tiers, like the local and remote nodes of a NUMA machine, or DRAM
+// and CXL-attached memory. Physical frames are split into tiers, fastest
+// first, each a contiguous range of frames with its own access cost, which
+// replaces cost_model.hit for references to pages in that tier.
+//
+// Free frames are taken from the fastest tier that has one (first touch,
+// since all references come from one CPU), or from each tier in turn
+// (interleave). Every tier_scan_interval references, the accessed bit of
+// every frame is sampled and cleared, like a kernel scanning page table
+// accessed bits. Pages that were accessed in each of the last two scans
+// are hot, and are promoted to the next faster tier, into a free frame or
+// in exchange for a page that was accessed in neither (a cold page, which
+// is demoted). Cold pages are also demoted out of a full tier while the
+// next slower one has free frames, to make room for new pages.
+
+#define MAX_TIERS 4
+
+struct tier {
+	size_t first;      // First frame in the tier
+	size_t frames;     // Number of frames
+	double ns;         // Cost of an access
+	size_t free;       // Free frames
+	size_t hand;       // Where the search for a cold page resumes
+	size_t accesses;   // References to pages in this tier
+	size_t promotions; // Pages moved in from the next slower tier
+	size_t demotions;  // Pages moved in from the next faster tier
+};
+
+// Configuration, set through tier_parse(). No tiers disables all of this.
+extern size_t num_tiers;
+extern struct tier tiers[MAX_TIERS];
+extern bool tier_interleave;
+extern size_t tier_scan_interval; // 0 disables migration
+extern size_t tier_migrate_max;   // Most pages moved per scan
+extern size_t tier_scans;
+
+// Parse a comma-separated list of tiers, fastest first, each "frames:ns",
+// where the frames of the last tier may be * for the rest of memory,
+// optionally followed by settings place=first|interleave, scan=refs and
+// max=pages.
+// Return: 0 on success, -1 if spec is malformed.
+extern int tier_parse(const char *spec);
+
+// Lay the tiers out over memory, once memsize is known.
+// Return: 0 on success, -1 if the tiers don't add up to memsize frames.
+extern int tier_init(void);
+extern void tier_destroy(void);
+
+// Frame allocation, from allocate_frame() and free_frame(). tier_alloc()
+// picks a free frame by the placement policy, and tier_placed() must be
+// called for every frame that gets a new page, free or evicted.
+extern int tier_alloc(void);
+extern void tier_placed(int frame);
+extern void tier_free(int frame);
+
+// Called from find_frame_number on every reference, before and after the
+// translation.
+extern void tier_tick(void);
+extern void tier_access(int frame);
+
+#endif /* __TIER_H__ */
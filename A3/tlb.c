@@ -0,0 +1,116 @@
+#include <string.h>
+#include "malloc369.h"
+#include "sim.h"
+#include "tlb.h"
+#include "snapshot.h"
+
+struct tlb_entry {
+	struct pt_entry_s *pte; // Cached page table entry, NULL if unused
+	vaddr_t vpn;
+	unsigned int asid;
+	unsigned long last_use; // For LRU replacement within a set
+};
+
+size_t tlb_entries = 0;
+size_t tlb_hit_count = 0;
+size_t tlb_miss_count = 0;
+
+static struct tlb_entry *tlb;
+static size_t tlb_sets;
+static unsigned long tlb_clock;
+
+void tlb_init(void)
+{
+	tlb_sets = (tlb_entries + TLB_WAYS - 1) / TLB_WAYS;
+	tlb = malloc369(tlb_sets * TLB_WAYS * sizeof(struct tlb_entry));
+	memset(tlb, 0, tlb_sets * TLB_WAYS * sizeof(struct tlb_entry));
+	tlb_clock = 0;
+}
+
+void tlb_destroy(void)
+{
+	free369(tlb);
+}
+
+static inline struct tlb_entry *tlb_set(unsigned int asid, vaddr_t vpn)
+{
+	return &tlb[((vpn ^ ((vaddr_t)asid * 0x9e3779b1)) % tlb_sets) * TLB_WAYS];
+}
+
+struct pt_entry_s *tlb_lookup(unsigned int asid, vaddr_t vpn)
+{
+	struct tlb_entry *set = tlb_set(asid, vpn);
+	for (int i = 0; i < TLB_WAYS; ++i) {
+		if (set[i].pte && set[i].vpn == vpn && set[i].asid == asid) {
+			set[i].last_use = ++tlb_clock;
+			++tlb_hit_count;
+			return set[i].pte;
+		}
+	}
+	++tlb_miss_count;
+	return NULL;
+}
+
+void tlb_insert(unsigned int asid, vaddr_t vpn, struct pt_entry_s *pte)
+{
+	struct tlb_entry *set = tlb_set(asid, vpn);
+	struct tlb_entry *victim = &set[0];
+	for (int i = 0; i < TLB_WAYS; ++i) {
+		if (!set[i].pte) {
+			victim = &set[i];
+			break;
+		}
+		if (set[i].last_use < victim->last_use) {
+			victim = &set[i];
+		}
+	}
+	victim->pte = pte;
+	victim->vpn = vpn;
+	victim->asid = asid;
+	victim->last_use = ++tlb_clock;
+}
+
+void tlb_invalidate(unsigned int asid, vaddr_t vpn)
+{
+	struct tlb_entry *set = tlb_set(asid, vpn);
+	for (int i = 0; i < TLB_WAYS; ++i) {
+		if (set[i].pte && set[i].vpn == vpn && set[i].asid == asid) {
+			set[i].pte = NULL;
+		}
+	}
+}
+
+// Snapshots. Cached entries are saved without their page table entry
+// pointers, which are looked up again from the restored page tables.
+void tlb_save(void)
+{
+	SNAP_WRITE(tlb_hit_count);
+	SNAP_WRITE(tlb_miss_count);
+	SNAP_WRITE(tlb_clock);
+	for (size_t i = 0; i < tlb_sets * TLB_WAYS; ++i) {
+		bool used = tlb[i].pte != NULL;
+		SNAP_WRITE(used);
+		if (used) {
+			SNAP_WRITE(tlb[i].vpn);
+			SNAP_WRITE(tlb[i].asid);
+			SNAP_WRITE(tlb[i].last_use);
+		}
+	}
+}
+
+void tlb_restore(void)
+{
+	SNAP_READ(tlb_hit_count);
+	SNAP_READ(tlb_miss_count);
+	SNAP_READ(tlb_clock);
+	for (size_t i = 0; i < tlb_sets * TLB_WAYS; ++i) {
+		bool used;
+		SNAP_READ(used);
+		if (used) {
+			SNAP_READ(tlb[i].vpn);
+			SNAP_READ(tlb[i].asid);
+			SNAP_READ(tlb[i].last_use);
+			tlb[i].pte = pagetable_entry(tlb[i].asid, tlb[i].vpn);
+		}
+	}
+}
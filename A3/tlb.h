@@ -0,0 +1,38 @@
+#ifndef __TLB_H__
+#define __TLB_H__
+
+#include <stddef.h>
+#include "sim.h"
+
+// Simulated translation lookaside buffer. It is set-associative, with
+// TLB_WAYS entries per set and LRU replacement within each set. Entries
+// are tagged with the ASID of the process that owns the translation, so
+// switching processes does not require a flush. Each entry caches a
+// pointer to the page table entry, so a TLB hit skips the page table walk.
+
+#define TLB_WAYS 4
+
+struct pt_entry_s;
+
+// Number of TLB entries, set by sim.c. 0 disables the TLB.
+extern size_t tlb_entries;
+
+// Counters for TLB events. Set in tlb.c, reported by sim.c
+extern size_t tlb_hit_count;
+extern size_t tlb_miss_count;
+
+extern void tlb_init(void);
+extern void tlb_destroy(void);
+
+// Returns the cached page table entry for vpn in address space asid, or
+// NULL if the translation is not in the TLB.
+extern struct pt_entry_s *tlb_lookup(unsigned int asid, vaddr_t vpn);
+
+// Cache the translation of vpn in address space asid to pte.
+extern void tlb_insert(unsigned int asid, vaddr_t vpn, struct pt_entry_s *pte);
+
+// Remove the translation of vpn in address space asid, if present.
+// Must be called whenever the page table entry becomes invalid.
+extern void tlb_invalidate(unsigned int asid, vaddr_t vpn);
+
+#endif /* __TLB_H__ */
@@ -0,0 +1,95 @@
+/*
+ * Live trace capture for sim.
+ *
+ * Runs a program with libtracecap.so preloaded, which records the pages
+ * it reads and writes, at page granularity, and writes them out as a
+ * trace that sim can replay. See tracecap_preload.c for how. Programs run
+ * close to native speed, apart from a few page faults per page for every
+ * sampling interval.
+ */
+
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LIBRARY_NAME "libtracecap.so"
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "USAGE: %s [-o tracefile -i ms -L library] program [args...]\n", prog);
+	fprintf(stderr, "\t-o tracefile - where to write the trace (default tracecap.tr)\n");
+	fprintf(stderr, "\t-i ms        - re-protect all pages every ms milliseconds of\n"
+	                "\t               CPU time (default 100)\n");
+	fprintf(stderr, "\t-L library   - path to %s (default: next to %s)\n",
+	        LIBRARY_NAME, prog);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *trace_path = "tracecap.tr";
+	const char *interval = "100";
+	char library[PATH_MAX];
+	library[0] = '\0';
+
+	int opt;
+	// '+' stops at the program name, so its own options are left alone
+	while ((opt = getopt(argc, argv, "+o:i:L:h")) != -1) {
+		switch (opt) {
+		case 'o':
+			trace_path = optarg;
+			break;
+		case 'i':
+			if (strtol(optarg, NULL, 10) <= 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			interval = optarg;
+			break;
+		case 'L':
+			if (!realpath(optarg, library)) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind == argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	// LD_PRELOAD needs an absolute path, since the program may chdir
+	if (library[0] == '\0') {
+		ssize_t len = readlink("/proc/self/exe", library, sizeof(library) - 1);
+		if (len < 0) {
+			perror("/proc/self/exe");
+			return 1;
+		}
+		library[len] = '\0';
+		char *slash = strrchr(library, '/');
+		size_t dirlen = slash ? (size_t)(slash - library + 1) : 0;
+		if (dirlen + strlen(LIBRARY_NAME) >= sizeof(library)) {
+			fprintf(stderr, "Path to %s is too long\n", LIBRARY_NAME);
+			return 1;
+		}
+		strcpy(library + dirlen, LIBRARY_NAME);
+	}
+	if (access(library, R_OK) != 0) {
+		perror(library);
+		return 1;
+	}
+
+	setenv("LD_PRELOAD", library, 1);
+	setenv("TRACECAP_OUT", trace_path, 1);
+	setenv("TRACECAP_INTERVAL", interval, 1);
+	execvp(argv[optind], &argv[optind]);
+	perror(argv[optind]);
+	return 1;
+}
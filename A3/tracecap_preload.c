@@ -0,0 +1,695 @@
+/*
+ * Trace capture library for tracecap, loaded into the target program with
+ * LD_PRELOAD.
+ *
+ * Every private, writable, anonymous mapping of the program (the heap,
+ * anonymous mmaps and the program's bss) is protected with PROT_NONE. The first
+ * access to a page then faults, and the SIGSEGV handler records it and
+ * opens the page up: to PROT_READ for a read, so that a later write faults
+ * again, or to PROT_READ | PROT_WRITE for a write. Whether the access was a
+ * write comes from the page fault error code. Every interval of user CPU
+ * time (ITIMER_VIRTUAL, so the time spent handling faults in the kernel
+ * does not count), a timer re-protects everything. The trace thus samples
+ * the program's accesses over time, at the cost of a few faults per page
+ * per interval.
+ *
+ * The scan only sees the mappings that exist when it runs. Memory that
+ * the program gets in between is protected as soon as it is handed out:
+ * the malloc family, mmap, mremap, brk and sbrk are wrapped, and whatever
+ * they return that the last scan did not see (and every page of a block
+ * of a page or more, which may have been unmapped and mapped again) is
+ * protected before the program sees it. Memory that libc maps for itself
+ * outside of malloc, like thread stacks, still waits for the next sample,
+ * and the zeroing done by calloc and the copying done by realloc are not
+ * recorded, since they happen before the block is protected.
+ *
+ * Accesses are recorded at page granularity, as references to the first
+ * byte of the page, with sim's trace format. Each page has a version
+ * number that is bumped by every recorded write, and written as the
+ * value, so the trace is consistent for sim's check of loaded values.
+ *
+ * Only the launched process is traced, not its children, and only its
+ * main thread: other threads would fault without the alternate signal
+ * stack. The kernel does not take protection faults on behalf of the
+ * program, so a system call that writes into a page that is protected at
+ * the time (e.g. stat(2) into a struct that has not been touched since
+ * the last re-protection) fails with EFAULT. read, pread, recv and fread
+ * are wrapped to open the buffer and try again, but other calls are not,
+ * which makes tracecap best suited to compute-bound programs.
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#if !defined(__x86_64__)
+#error "tracecap reads the page fault error code from the x86-64 signal context"
+#endif
+
+#define TC_PAGE_SIZE 4096UL
+#define TC_PAGE_SHIFT 12
+#define TC_WRITE_FAULT 0x2     // Page fault error code bit for writes
+#define MAX_REGIONS 4096
+#define OUT_BUFSIZE (64 * 1024)
+#define MAPS_BUFSIZE (256 * 1024)
+#define ALTSTACK_SIZE (64 * 1024)
+#define TABLE_BITS 22          // Room for 4M distinct pages
+#define FIRST_SAMPLE_US 1000   // CPU time before the first re-protection
+
+struct region {
+	uintptr_t start;
+	uintptr_t end;
+};
+
+// All of the library's state, in one place so that it can be left out of
+// the regions that are protected
+static struct {
+	bool started;                // Set up, and output not yet closed
+	bool active;                 // Pages are being protected and recorded
+	bool table_full;
+	int fd;
+	uintptr_t tls_page;          // Page holding the thread pointer
+	uint64_t *table;             // Version of every page seen, see below
+	size_t table_used;
+	struct region regions[MAX_REGIONS]; // Regions protected by the last scan
+	size_t num_regions;
+	size_t events;
+	size_t samples;
+	size_t outlen;
+	void *(*real_mmap)(void *, size_t, int, int, int, off_t);
+	void *(*real_mremap)(void *, size_t, size_t, int, void *);
+	int (*real_brk)(void *);
+	void *(*real_sbrk)(intptr_t);
+	ssize_t (*real_read)(int, void *, size_t);
+	ssize_t (*real_pread)(int, void *, size_t, off_t);
+	ssize_t (*real_recvfrom)(int, void *, size_t, int, struct sockaddr *, socklen_t *);
+	size_t (*real_fread)(void *, size_t, size_t, FILE *);
+	size_t (*real_fread_unlocked)(void *, size_t, size_t, FILE *);
+	char out[OUT_BUFSIZE];
+	char maps[MAPS_BUFSIZE];
+	unsigned char altstack[ALTSTACK_SIZE];
+} tc;
+
+//---------------------------------------------------------------------
+// Page versions. Open addressing, each slot holds (vpn + 1) << 8 | version,
+// 0 if unused. The table is an anonymous mapping that is only populated
+// as it is used.
+
+static const size_t table_size = (size_t)1 << TABLE_BITS;
+
+static uint64_t *table_slot(uintptr_t vpn)
+{
+	size_t i = (vpn * 0x9e3779b97f4a7c15ULL) >> (64 - TABLE_BITS);
+	while (tc.table[i] != 0 && (tc.table[i] >> 8) != vpn + 1) {
+		i = (i + 1) & (table_size - 1);
+	}
+	return &tc.table[i];
+}
+
+//---------------------------------------------------------------------
+// Output. Nothing from stdio is used while tracing, since the handlers
+// may run in the middle of any libc function.
+
+static void out_flush(void)
+{
+	size_t done = 0;
+	while (done < tc.outlen) {
+		ssize_t n = write(tc.fd, tc.out + done, tc.outlen - done);
+		if (n <= 0) {
+			break;
+		}
+		done += n;
+	}
+	tc.outlen = 0;
+}
+
+// Append "type vaddr value\n", like printf("%c %lx %u\n") would
+static void out_event(char type, uintptr_t vaddr, unsigned value)
+{
+	static const char hex[] = "0123456789abcdef";
+	char tmp[24];
+	int n;
+
+	if (tc.outlen + 64 > OUT_BUFSIZE) {
+		out_flush();
+	}
+	char *p = tc.out + tc.outlen;
+	*p++ = type;
+	*p++ = ' ';
+	n = 0;
+	do {
+		tmp[n++] = hex[vaddr & 0xf];
+		vaddr >>= 4;
+	} while (vaddr);
+	while (n > 0) {
+		*p++ = tmp[--n];
+	}
+	*p++ = ' ';
+	do {
+		tmp[n++] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+	while (n > 0) {
+		*p++ = tmp[--n];
+	}
+	*p++ = '\n';
+	tc.outlen = p - tc.out;
+	tc.events++;
+}
+
+//---------------------------------------------------------------------
+// Protection.
+
+static bool overlaps(uintptr_t start, uintptr_t end, uintptr_t lo, uintptr_t hi)
+{
+	return start < hi && lo < end;
+}
+
+// Returns true if the mapping [start, end) must be left alone: it holds
+// our own state, or the thread control block, which libc and the kernel
+// (for rseq) access behind the program's back.
+static bool excluded(uintptr_t start, uintptr_t end)
+{
+	return overlaps(start, end, (uintptr_t)&tc, (uintptr_t)(&tc + 1)) ||
+	       overlaps(start, end, (uintptr_t)tc.table,
+	                (uintptr_t)(tc.table + table_size)) ||
+	       overlaps(start, end, tc.tls_page - TC_PAGE_SIZE, tc.tls_page + TC_PAGE_SIZE);
+}
+
+static uintptr_t parse_hex(const char **s)
+{
+	uintptr_t v = 0;
+	for (;; (*s)++) {
+		char c = **s;
+		if (c >= '0' && c <= '9') {
+			v = v * 16 + (c - '0');
+		} else if (c >= 'a' && c <= 'f') {
+			v = v * 16 + (c - 'a' + 10);
+		} else {
+			return v;
+		}
+	}
+}
+
+// Read /proc/self/maps and protect every region that we trace, recording
+// them in tc.regions. Lines look like
+//   start-end perms offset dev inode [path]
+static void protect_all(void)
+{
+	int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return;
+	}
+	size_t len = 0;
+	ssize_t n;
+	while (len < MAPS_BUFSIZE - 1 &&
+	       (n = read(fd, tc.maps + len, MAPS_BUFSIZE - 1 - len)) > 0) {
+		len += n;
+	}
+	close(fd);
+	tc.maps[len] = '\0';
+
+	tc.num_regions = 0;
+	uintptr_t library_end = 0; // End of the last shared library mapping
+	const char *line = tc.maps;
+	while (*line && tc.num_regions < MAX_REGIONS) {
+		const char *eol = strchr(line, '\n');
+		if (!eol) {
+			break;
+		}
+		const char *p = line;
+		uintptr_t start = parse_hex(&p);
+		p++;
+		uintptr_t end = parse_hex(&p);
+		p++;
+		bool rw_private = strncmp(p, "rw-p", 4) == 0;
+
+		// Skip offset, dev and inode to get to the path, if any
+		for (int field = 0; field < 4 && p < eol; field++) {
+			while (p < eol && *p != ' ') {
+				p++;
+			}
+			while (p < eol && *p == ' ') {
+				p++;
+			}
+		}
+		bool anonymous = (p == eol) || strncmp(p, "[heap]", 6) == 0;
+
+		// The bss of shared libraries is left alone, since the handlers
+		// use libc, and libc uses its bss
+		bool library_bss = anonymous && start == library_end;
+		if (p < eol && memmem(p, eol - p, ".so", 3)) {
+			library_end = end;
+		}
+
+		if (rw_private && anonymous && !library_bss && !excluded(start, end) &&
+		    mprotect((void *)start, end - start, PROT_NONE) == 0) {
+			tc.regions[tc.num_regions].start = start;
+			tc.regions[tc.num_regions].end = end;
+			tc.num_regions++;
+		}
+		line = eol + 1;
+	}
+}
+
+static void unprotect_all(void)
+{
+	for (size_t i = 0; i < tc.num_regions; i++) {
+		mprotect((void *)tc.regions[i].start,
+		         tc.regions[i].end - tc.regions[i].start,
+		         PROT_READ | PROT_WRITE);
+	}
+	tc.num_regions = 0;
+}
+
+// Returns the region protected by the last scan that holds addr, or NULL
+static struct region *protected_region(uintptr_t addr)
+{
+	for (size_t i = 0; i < tc.num_regions; i++) {
+		if (addr >= tc.regions[i].start && addr < tc.regions[i].end) {
+			return &tc.regions[i];
+		}
+	}
+	return NULL;
+}
+
+//---------------------------------------------------------------------
+// New memory. malloc grows the heap and maps large blocks with libc's
+// internal versions of sbrk and mmap, which cannot be interposed, so the
+// blocks it returns are protected instead.
+
+// Exported by libc for wrappers like these, so that they need not look
+// up the real functions with dlsym, which may call calloc itself
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+// The next definition of name, looked up the first time it is needed,
+// since other libraries' constructors may call it before ours
+#define RESOLVE(name) \
+	if (!tc.real_##name) \
+		tc.real_##name = dlsym(RTLD_NEXT, #name)
+
+static bool on_main_thread(void)
+{
+	return ((uintptr_t)__builtin_thread_pointer() & ~(TC_PAGE_SIZE - 1)) == tc.tls_page;
+}
+
+// Protect the pages of [start, end) that the last scan did not see, or
+// all of them if all is set, and add them to tc.regions
+static void protect_new(uintptr_t start, uintptr_t end, bool all)
+{
+	start &= ~(TC_PAGE_SIZE - 1);
+	end = (end + TC_PAGE_SIZE - 1) & ~(TC_PAGE_SIZE - 1);
+	if (!tc.active || start >= end || !on_main_thread() || excluded(start, end)) {
+		return;
+	}
+	// Most blocks come from memory that has been scanned already
+	struct region *r = protected_region(start);
+	if (!all && r && end <= r->end) {
+		return;
+	}
+
+	// The timer rewrites tc.regions
+	sigset_t timer, old;
+	sigemptyset(&timer);
+	sigaddset(&timer, SIGVTALRM);
+	pthread_sigmask(SIG_BLOCK, &timer, &old);
+	r = protected_region(start);
+	if (r) {
+		// Grow the region, which keeps the list short as the heap grows
+		uintptr_t from = all ? start : r->end;
+		if (end > from && mprotect((void *)from, end - from, PROT_NONE) == 0 &&
+		    end > r->end) {
+			r->end = end;
+		}
+	} else if (tc.num_regions < MAX_REGIONS &&
+	           mprotect((void *)start, end - start, PROT_NONE) == 0) {
+		tc.regions[tc.num_regions].start = start;
+		tc.regions[tc.num_regions].end = end;
+		tc.num_regions++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+static void *new_block(void *ptr, size_t size)
+{
+	if (ptr) {
+		protect_new((uintptr_t)ptr, (uintptr_t)ptr + size, size >= TC_PAGE_SIZE);
+	}
+	return ptr;
+}
+
+void *malloc(size_t size)
+{
+	return new_block(__libc_malloc(size), size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	void *ptr = __libc_calloc(nmemb, size);
+	return ptr ? new_block(ptr, nmemb * size) : NULL;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	return new_block(__libc_realloc(ptr, size), size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	return new_block(__libc_memalign(alignment, size), size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	return memalign(alignment, size);
+}
+
+void *valloc(size_t size)
+{
+	return memalign(TC_PAGE_SIZE, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) {
+		return EINVAL;
+	}
+	void *ptr = memalign(alignment, size);
+	if (!ptr) {
+		return ENOMEM;
+	}
+	*memptr = ptr;
+	return 0;
+}
+
+// Only the mappings that the scan would pick up: private, anonymous and
+// read-write
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+	RESOLVE(mmap);
+	void *ptr = tc.real_mmap(addr, length, prot, flags, fd, offset);
+	if (ptr != MAP_FAILED && (flags & (MAP_PRIVATE | MAP_ANONYMOUS | MAP_SHARED)) ==
+	                         (MAP_PRIVATE | MAP_ANONYMOUS) &&
+	    prot == (PROT_READ | PROT_WRITE)) {
+		protect_new((uintptr_t)ptr, (uintptr_t)ptr + length, true);
+	}
+	return ptr;
+}
+
+void *mmap64(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+	return mmap(addr, length, prot, flags, fd, offset);
+}
+
+void *mremap(void *old_address, size_t old_size, size_t new_size, int flags, ...)
+{
+	void *new_address = NULL;
+	if (flags & MREMAP_FIXED) {
+		va_list ap;
+		va_start(ap, flags);
+		new_address = va_arg(ap, void *);
+		va_end(ap);
+	}
+	bool traced = protected_region((uintptr_t)old_address) != NULL;
+	RESOLVE(mremap);
+	void *ptr = tc.real_mremap(old_address, old_size, new_size, flags, new_address);
+	if (ptr != MAP_FAILED && traced) {
+		protect_new((uintptr_t)ptr, (uintptr_t)ptr + new_size, true);
+	}
+	return ptr;
+}
+
+int brk(void *addr)
+{
+	RESOLVE(brk);
+	RESOLVE(sbrk);
+	uintptr_t old = (uintptr_t)tc.real_sbrk(0);
+	int ret = tc.real_brk(addr);
+	if (ret == 0) {
+		protect_new(old, (uintptr_t)addr, true);
+	}
+	return ret;
+}
+
+void *sbrk(intptr_t increment)
+{
+	RESOLVE(sbrk);
+	void *old = tc.real_sbrk(increment);
+	if (old != (void *)-1 && increment > 0) {
+		protect_new((uintptr_t)old, (uintptr_t)old + increment, true);
+	}
+	return old;
+}
+
+// A system call fails with EFAULT on a protected page rather than fault,
+// and buffers are protected as soon as they are allocated. The calls that
+// programs read into them with most often write to the buffer's protected
+// pages themselves (a write, as the kernel's would be) and try again.
+static void open_for_kernel(void *buf, size_t len)
+{
+	uintptr_t start = (uintptr_t)buf;
+	for (uintptr_t page = start & ~(TC_PAGE_SIZE - 1); page < start + len;
+	     page += TC_PAGE_SIZE) {
+		if (protected_region(page)) {
+			unsigned char *p = (unsigned char *)(page < start ? start : page);
+			__atomic_fetch_or(p, 0, __ATOMIC_RELAXED); // Faults as a write
+		}
+	}
+}
+
+#define RETRY_EFAULT(call, buf, len) \
+	ssize_t ret = call; \
+	if (ret < 0 && errno == EFAULT && tc.active && on_main_thread()) { \
+		open_for_kernel(buf, len); \
+		ret = call; \
+	} \
+	return ret
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+	RESOLVE(read);
+	RETRY_EFAULT(tc.real_read(fd, buf, count), buf, count);
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset)
+{
+	RESOLVE(pread);
+	RETRY_EFAULT(tc.real_pread(fd, buf, count, offset), buf, count);
+}
+
+ssize_t pread64(int fd, void *buf, size_t count, off_t offset)
+{
+	return pread(fd, buf, count, offset);
+}
+
+ssize_t recvfrom(int fd, void *buf, size_t len, int flags,
+                 struct sockaddr *src_addr, socklen_t *addrlen)
+{
+	RESOLVE(recvfrom);
+	RETRY_EFAULT(tc.real_recvfrom(fd, buf, len, flags, src_addr, addrlen), buf, len);
+}
+
+ssize_t recv(int fd, void *buf, size_t len, int flags)
+{
+	return recvfrom(fd, buf, len, flags, NULL, NULL);
+}
+
+// Large freads go straight into the buffer with libc's internal read
+#define FREAD_RETRY_EFAULT(name, ptr, size, nmemb, stream) \
+	RESOLVE(name); \
+	size_t done = tc.real_##name(ptr, size, nmemb, stream); \
+	if (done < nmemb && ferror(stream) && errno == EFAULT && tc.active && \
+	    on_main_thread()) { \
+		char *rest = (char *)ptr + done * size; \
+		clearerr(stream); \
+		open_for_kernel(rest, (nmemb - done) * size); \
+		done += tc.real_##name(rest, size, nmemb - done, stream); \
+	} \
+	return done
+
+size_t fread(void *ptr, size_t size, size_t nmemb, FILE *stream)
+{
+	FREAD_RETRY_EFAULT(fread, ptr, size, nmemb, stream);
+}
+
+#undef fread_unlocked // An inline version in <stdio.h>
+size_t fread_unlocked(void *ptr, size_t size, size_t nmemb, FILE *stream)
+{
+	FREAD_RETRY_EFAULT(fread_unlocked, ptr, size, nmemb, stream);
+}
+
+//---------------------------------------------------------------------
+// Signal handlers.
+
+static void stop_tracing(void)
+{
+	tc.active = false;
+	struct itimerval off = { { 0, 0 }, { 0, 0 } };
+	setitimer(ITIMER_VIRTUAL, &off, NULL);
+	unprotect_all();
+}
+
+static void fault_handler(int sig, siginfo_t *info, void *context)
+{
+	ucontext_t *uc = (ucontext_t *)context;
+	uintptr_t addr = (uintptr_t)info->si_addr;
+	struct region *r = tc.active ? protected_region(addr) : NULL;
+
+	if (!r || info->si_code != SEGV_ACCERR) {
+		// A real crash. Let it happen when the access is retried.
+		signal(sig, SIG_DFL);
+		return;
+	}
+
+	uintptr_t page = addr & ~(TC_PAGE_SIZE - 1);
+	uintptr_t vpn = page >> TC_PAGE_SHIFT;
+	uint64_t *slot = table_slot(vpn);
+	if (*slot == 0) {
+		if (++tc.table_used > table_size / 4 * 3) {
+			// Out of room. Keep what we have and stop.
+			tc.table_full = true;
+			stop_tracing();
+			out_flush();
+			return;
+		}
+		*slot = (uint64_t)(vpn + 1) << 8;
+	}
+
+	int prot;
+	if (uc->uc_mcontext.gregs[REG_ERR] & TC_WRITE_FAULT) {
+		*slot = (*slot & ~(uint64_t)0xff) | ((*slot + 1) & 0xff);
+		out_event('S', page, *slot & 0xff);
+		prot = PROT_READ | PROT_WRITE;
+	} else {
+		out_event('L', page, *slot & 0xff);
+		prot = PROT_READ;
+	}
+	// Every page with its own protection is a separate mapping in the
+	// kernel, and there is a limit on those (vm.max_map_count). If we hit
+	// it, open up the whole region until the next sample.
+	if (mprotect((void *)page, TC_PAGE_SIZE, prot) != 0) {
+		mprotect((void *)r->start, r->end - r->start, PROT_READ | PROT_WRITE);
+	}
+}
+
+static void timer_handler(int sig)
+{
+	(void)sig;
+	if (!tc.active) {
+		return;
+	}
+	tc.samples++;
+	out_flush();
+	// Opening everything up first merges the pieces that faults split
+	// off each region back together, so the scan sees them as rw-p again
+	unprotect_all();
+	protect_all();
+}
+
+//---------------------------------------------------------------------
+// Setup and teardown.
+
+// A forked child runs with our handlers and a copy of the buffer. Its
+// accesses are not traced, so drop the copy and open everything up.
+static void child_after_fork(void)
+{
+	if (tc.started) {
+		tc.outlen = 0;
+		tc.started = false;
+		tc.active = false;
+		unprotect_all();
+	}
+}
+
+__attribute__((constructor))
+static void tracecap_start(void)
+{
+	const char *path = getenv("TRACECAP_OUT");
+	if (!path) {
+		return; // Not started by tracecap
+	}
+	const char *interval_env = getenv("TRACECAP_INTERVAL");
+	long interval_ms = interval_env ? strtol(interval_env, NULL, 10) : 100;
+	unsetenv("LD_PRELOAD"); // Only trace this process
+
+	tc.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (tc.fd < 0) {
+		perror(path);
+		return;
+	}
+	tc.table = mmap(NULL, table_size * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+	                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (tc.table == MAP_FAILED) {
+		perror("tracecap: page table");
+		close(tc.fd);
+		return;
+	}
+	tc.tls_page = (uintptr_t)__builtin_thread_pointer() & ~(TC_PAGE_SIZE - 1);
+
+	stack_t ss = { .ss_sp = tc.altstack, .ss_size = ALTSTACK_SIZE, .ss_flags = 0 };
+	sigaltstack(&ss, NULL);
+
+	// Each handler blocks the other, so they never interleave
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = fault_handler;
+	sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaddset(&sa.sa_mask, SIGVTALRM);
+	sigaction(SIGSEGV, &sa, NULL);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = timer_handler;
+	sa.sa_flags = SA_ONSTACK | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaddset(&sa.sa_mask, SIGSEGV);
+	sigaction(SIGVTALRM, &sa, NULL);
+
+	pthread_atfork(NULL, NULL, child_after_fork);
+
+	struct itimerval its;
+	its.it_interval.tv_sec = interval_ms / 1000;
+	its.it_interval.tv_usec = (interval_ms % 1000) * 1000;
+	// The first sample comes early, to catch memory that libc maps for
+	// itself just after the program starts
+	its.it_value.tv_sec = 0;
+	its.it_value.tv_usec = FIRST_SAMPLE_US;
+	setitimer(ITIMER_VIRTUAL, &its, NULL);
+
+	tc.started = true;
+	tc.active = true;
+	protect_all();
+}
+
+__attribute__((destructor))
+static void tracecap_finish(void)
+{
+	if (!tc.started) {
+		return;
+	}
+	if (tc.active) {
+		stop_tracing();
+	}
+	out_flush();
+	close(tc.fd);
+	tc.started = false;
+	fprintf(stderr, "tracecap: %zu references to %zu pages in %zu samples%s\n",
+	        tc.events, tc.table_used, tc.samples + 1,
+	        tc.table_full ? " (too many pages, trace cut short)" : "");
+}
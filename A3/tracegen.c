@@ -0,0 +1,311 @@
+/*
+ * Synthetic trace generator for sim.
+ *
+ * Writes a reference trace in the "type vaddr value" format that sim
+ * replays, with values that match what is in memory at that point of the
+ * trace, so sim can check that paging preserved the contents of every page.
+ * Every run with the same options and seed produces the same trace.
+ *
+ * With -c, the trace has several processes, each following the pattern
+ * over its own memory, taking turns in bursts of references.
+ *
+ * With -u, the running process unmaps a random range of its pages now and
+ * then. The pages read as zero when they are next used.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BASE_VADDR 0x10000000UL
+#define TRACE_PAGE_SIZE 4096
+
+enum pattern { SEQ, LOOP, ZIPF, UNIFORM, STRIDE, PHASE };
+
+static const char *pattern_names[] = {
+	[SEQ] = "seq",
+	[LOOP] = "loop",
+	[ZIPF] = "zipf",
+	[UNIFORM] = "uniform",
+	[STRIDE] = "stride",
+	[PHASE] = "phase",
+};
+#define NUM_PATTERNS (int)(sizeof(pattern_names) / sizeof(pattern_names[0]))
+
+// Options
+static enum pattern pattern = ZIPF;
+static size_t nrefs = 100000;
+static size_t npages = 1000;     // Pages in the working set
+static size_t pagebytes = 16;    // Bytes used per page, sim's page size
+static double write_frac = 0.3;  // Fraction of references that are writes
+static double alpha = 1.0;       // Zipf exponent
+static size_t stride = 7;        // Stride in pages
+static size_t loop_pages = 0;    // Pages in the loop, default 3/4 of npages
+static size_t phase_len = 0;     // References per phase, default nrefs / 8
+static size_t nprocs = 1;        // Processes
+static size_t burst = 1000;      // References per turn of a process
+static size_t unmap_period = 0;  // References between unmaps, 0 for none
+static uint64_t seed = 1;
+
+//---------------------------------------------------------------------
+// Random numbers. splitmix64, so traces are the same on every platform.
+
+static uint64_t rng_state;
+
+static uint64_t rng_next(void)
+{
+	uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+// Uniform in [0, n)
+static size_t rng_below(size_t n)
+{
+	return rng_next() % n;
+}
+
+// Uniform in [0, 1)
+static double rng_double(void)
+{
+	return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//---------------------------------------------------------------------
+// Zipf distribution over npages pages. Ranks are mapped to pages through a
+// random permutation, so the hot pages are spread over the address space.
+
+static double *zipf_cdf;
+static size_t *zipf_page;
+
+static void zipf_init(void)
+{
+	zipf_cdf = malloc(npages * sizeof(double));
+	zipf_page = malloc(npages * sizeof(size_t));
+	double sum = 0.0;
+	for (size_t i = 0; i < npages; i++) {
+		sum += 1.0 / pow(i + 1, alpha);
+		zipf_cdf[i] = sum;
+		zipf_page[i] = i;
+	}
+	for (size_t i = 0; i < npages; i++) {
+		zipf_cdf[i] /= sum;
+	}
+	for (size_t i = npages - 1; i > 0; i--) {
+		size_t j = rng_below(i + 1);
+		size_t tmp = zipf_page[i];
+		zipf_page[i] = zipf_page[j];
+		zipf_page[j] = tmp;
+	}
+}
+
+static size_t zipf_next(void)
+{
+	double u = rng_double();
+	size_t lo = 0;
+	size_t hi = npages - 1;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (zipf_cdf[mid] < u) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return zipf_page[lo];
+}
+
+//---------------------------------------------------------------------
+// Patterns. Each returns the page and byte offset of the i'th reference.
+
+static size_t cursor; // Position within a sequential or strided walk
+
+static void next_ref(enum pattern p, size_t i, size_t *page, size_t *offset)
+{
+	switch (p) {
+	case SEQ:
+		// Touch every byte of every page in order, then start over
+		*page = (cursor / pagebytes) % npages;
+		*offset = cursor % pagebytes;
+		cursor++;
+		return;
+	case LOOP:
+		*page = (cursor / pagebytes) % loop_pages;
+		*offset = cursor % pagebytes;
+		cursor++;
+		return;
+	case ZIPF:
+		*page = zipf_next();
+		break;
+	case UNIFORM:
+		*page = rng_below(npages);
+		break;
+	case STRIDE:
+		// Walk an array with a stride of several pages, shifting the
+		// start by one page each time around
+		*page = (cursor * stride + cursor * stride / npages) % npages;
+		cursor++;
+		break;
+	case PHASE: {
+		// Cycle through the other patterns, each over a working set
+		// shifted by half of npages from the last one
+		size_t phase = i / phase_len;
+		enum pattern sub = (enum pattern[]){ LOOP, ZIPF, SEQ, UNIFORM, STRIDE }[phase % 5];
+		next_ref(sub, i, page, offset);
+		*page += (phase % 5) * (npages / 2);
+		return;
+	}
+	}
+	*offset = rng_below(pagebytes);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "USAGE: %s [-p pattern -n refs -w pages -g pagebytes "
+	        "-W writefrac -a alpha -S stride -L looppages -P phaselen -c procs -b burst -u period -s seed]\n", prog);
+	fprintf(stderr, "\t-p pattern   - one of seq, loop, zipf (default), uniform, stride, phase\n");
+	fprintf(stderr, "\t-n refs      - number of references (default 100000)\n");
+	fprintf(stderr, "\t-w pages     - working set size in pages (default 1000)\n");
+	fprintf(stderr, "\t-g pagebytes - bytes used in each page, sim's page size (default 16)\n");
+	fprintf(stderr, "\t-W writefrac - fraction of references that are writes (default 0.3)\n");
+	fprintf(stderr, "\t-a alpha     - zipf exponent (default 1.0)\n");
+	fprintf(stderr, "\t-S stride    - stride in pages for stride (default 7)\n");
+	fprintf(stderr, "\t-L pages     - pages in the loop for loop (default 3/4 of -w)\n");
+	fprintf(stderr, "\t-P phaselen  - references per phase for phase (default refs/8)\n");
+	fprintf(stderr, "\t-c procs     - number of processes (default 1)\n");
+	fprintf(stderr, "\t-b burst     - references per turn of a process (default 1000)\n");
+	fprintf(stderr, "\t-u period    - unmap a range of up to 1/8 of the pages every\n"
+	        "\t               period references (default never)\n");
+	fprintf(stderr, "\t-s seed      - random seed (default 1)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "p:n:w:g:W:a:S:L:P:c:b:u:s:h")) != -1) {
+		switch (opt) {
+		case 'p':
+			pattern = NUM_PATTERNS;
+			for (int i = 0; i < NUM_PATTERNS; i++) {
+				if (strcmp(optarg, pattern_names[i]) == 0) {
+					pattern = i;
+				}
+			}
+			if ((int)pattern == NUM_PATTERNS) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'n':
+			nrefs = strtoul(optarg, NULL, 10);
+			break;
+		case 'w':
+			npages = strtoul(optarg, NULL, 10);
+			break;
+		case 'g':
+			pagebytes = strtoul(optarg, NULL, 10);
+			break;
+		case 'W':
+			write_frac = strtod(optarg, NULL);
+			break;
+		case 'a':
+			alpha = strtod(optarg, NULL);
+			break;
+		case 'S':
+			stride = strtoul(optarg, NULL, 10);
+			break;
+		case 'L':
+			loop_pages = strtoul(optarg, NULL, 10);
+			break;
+		case 'P':
+			phase_len = strtoul(optarg, NULL, 10);
+			break;
+		case 'c':
+			nprocs = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			burst = strtoul(optarg, NULL, 10);
+			break;
+		case 'u':
+			unmap_period = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 10);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (npages == 0 || pagebytes == 0 || pagebytes > TRACE_PAGE_SIZE ||
+	    nprocs == 0 || burst == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (loop_pages == 0 || loop_pages > npages) {
+		loop_pages = npages * 3 / 4 ? npages * 3 / 4 : 1;
+	}
+	if (phase_len == 0) {
+		phase_len = nrefs / 8 ? nrefs / 8 : 1;
+	}
+
+	rng_state = seed;
+	zipf_init();
+
+	// Current contents of every byte the trace can touch, for each
+	// process. The phase pattern moves its working set over 3 times
+	// npages pages.
+	size_t span = (pattern == PHASE) ? npages * 3 : npages;
+	unsigned char *mem = calloc(span * nprocs, pagebytes);
+	size_t *cursors = calloc(nprocs, sizeof(size_t));
+	size_t *counts = calloc(nprocs, sizeof(size_t)); // References so far
+	if (!mem || !cursors || !counts) {
+		perror("calloc");
+		return 1;
+	}
+
+	size_t proc = 0;
+	for (size_t i = 0; i < nrefs; i++) {
+		if (nprocs > 1 && i % burst == 0) {
+			cursors[proc] = cursor;
+			proc = (i / burst) % nprocs;
+			cursor = cursors[proc];
+			printf("P %zu\n", proc + 1);
+		}
+		if (unmap_period > 0 && i > 0 && i % unmap_period == 0) {
+			size_t first = rng_below(span);
+			size_t len = 1 + rng_below(npages / 8 ? npages / 8 : 1);
+			if (len > span - first) {
+				len = span - first;
+			}
+			printf("U %lx %zu\n", BASE_VADDR + first * TRACE_PAGE_SIZE, len);
+			memset(&mem[(proc * span + first) * pagebytes], 0, len * pagebytes);
+		}
+		size_t page;
+		size_t offset;
+		next_ref(pattern, counts[proc]++, &page, &offset);
+		unsigned char *byte = &mem[(proc * span + page) * pagebytes + offset];
+		unsigned long vaddr = BASE_VADDR + page * TRACE_PAGE_SIZE + offset;
+
+		char type;
+		if (rng_double() < write_frac) {
+			type = (rng_below(2) == 0) ? 'S' : 'M';
+			*byte = rng_next() & 0xff;
+		} else {
+			type = (rng_below(4) == 0) ? 'I' : 'L';
+		}
+		printf("%c %lx %u\n", type, vaddr, *byte);
+	}
+
+	free(mem);
+	free(cursors);
+	free(counts);
+	free(zipf_cdf);
+	free(zipf_page);
+	return 0;
+}
@@ -0,0 +1,306 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "malloc369.h"
+#include "sim.h"
+#include "list.h"
+#include "zswap.h"
+#include "snapshot.h"
+
+//---------------------------------------------------------------------
+// Page compression.
+//
+// Pages that consist of a single repeated byte (most commonly zero-filled
+// pages) are stored as just that byte. Everything else goes through a
+// small LZ77-style compressor. The compressed stream is a sequence of
+// tokens, each starting with a control byte c:
+//   c < 0x80:  a run of c + 1 literal bytes follows
+//   c >= 0x80: copy (c & 0x7f) + LZ_MIN_MATCH bytes starting 'distance'
+//              bytes back in the output, where 'distance' is stored in
+//              the next two bytes (little-endian)
+// Matches are found through a hash table of the most recent position of
+// each 3-byte sequence, like LZ4 and friends.
+
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (0x7f + LZ_MIN_MATCH)
+#define LZ_MAX_LITERALS 0x80
+#define LZ_HASH_BITS 8
+#define LZ_NO_POS 0xffff
+
+static inline unsigned lz_hash(const unsigned char *p)
+{
+	uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Append literals in[start, end) to out. Returns the new output length,
+// or 0 if they would not fit in 'max' bytes.
+static size_t lz_literals(const unsigned char *in, size_t start, size_t end,
+                          unsigned char *out, size_t op, size_t max)
+{
+	while (start < end) {
+		size_t run = end - start;
+		if (run > LZ_MAX_LITERALS) {
+			run = LZ_MAX_LITERALS;
+		}
+		if (op + 1 + run > max) {
+			return 0;
+		}
+		out[op++] = run - 1;
+		memcpy(&out[op], &in[start], run);
+		op += run;
+		start += run;
+	}
+	return op;
+}
+
+// Compress n bytes from in into out. Returns the compressed length, or 0
+// if the result would not be smaller than 'max' bytes.
+static size_t lz_compress(const unsigned char *in, size_t n,
+                          unsigned char *out, size_t max)
+{
+	uint16_t table[1 << LZ_HASH_BITS];
+	memset(table, 0xff, sizeof(table));
+
+	size_t ip = 0;  // Next input byte to look at
+	size_t lit = 0; // Start of pending literals
+	size_t op = 0;
+	while (ip + LZ_MIN_MATCH <= n) {
+		unsigned h = lz_hash(&in[ip]);
+		size_t cand = table[h];
+		table[h] = ip;
+		if (cand == LZ_NO_POS || memcmp(&in[cand], &in[ip], LZ_MIN_MATCH) != 0) {
+			++ip;
+			continue;
+		}
+
+		size_t len = LZ_MIN_MATCH;
+		while (ip + len < n && len < LZ_MAX_MATCH && in[cand + len] == in[ip + len]) {
+			++len;
+		}
+		if (lit < ip && (op = lz_literals(in, lit, ip, out, op, max)) == 0) {
+			return 0;
+		}
+		if (op + 3 > max) {
+			return 0;
+		}
+		size_t distance = ip - cand;
+		out[op++] = 0x80 | (len - LZ_MIN_MATCH);
+		out[op++] = distance & 0xff;
+		out[op++] = distance >> 8;
+		ip += len;
+		lit = ip;
+	}
+	if (lit < n && (op = lz_literals(in, lit, n, out, op, max)) == 0) {
+		return 0;
+	}
+	return op < max ? op : 0;
+}
+
+static void lz_decompress(const unsigned char *in, size_t len,
+                          unsigned char *out, size_t n)
+{
+	size_t ip = 0;
+	size_t op = 0;
+	while (ip < len) {
+		unsigned char c = in[ip++];
+		if (c < 0x80) {
+			memcpy(&out[op], &in[ip], c + 1);
+			ip += c + 1;
+			op += c + 1;
+		} else {
+			size_t count = (c & 0x7f) + LZ_MIN_MATCH;
+			size_t distance = in[ip] | (in[ip + 1] << 8);
+			ip += 2;
+			// Byte by byte, since the source may overlap the destination
+			for (size_t i = 0; i < count; ++i, ++op) {
+				out[op] = out[op - distance];
+			}
+		}
+	}
+	assert(op == n);
+	(void)n;
+}
+
+//---------------------------------------------------------------------
+// Compressed pool.
+
+struct zswap_entry {
+	off_t offset;            // Swap slot that this page belongs to
+	list_entry lru_entry;    // Position in LRU list, most recent at tail
+	size_t len;              // Size of compressed data
+	bool same;               // true if page is data[0] repeated
+	unsigned char data[];
+};
+
+size_t zswap_pool_limit = 0;
+size_t zswap_stores = 0;
+size_t zswap_rejects = 0;
+size_t zswap_same_pages = 0;
+size_t zswap_loads = 0;
+size_t zswap_spills = 0;
+size_t zswap_pool_bytes = 0;
+size_t zswap_pool_peak = 0;
+size_t zswap_pool_pages = 0;
+
+static struct zswap_entry **zslots; // Pool entry for each swap slot
+static list_head zswap_lru;
+static unsigned char *zbuf;         // Scratch space for (de)compression
+static void (*zswap_writeback)(off_t offset, const void *data);
+
+void zswap_init(size_t nslots, void (*writeback)(off_t, const void *))
+{
+	zslots = malloc369(nslots * sizeof(struct zswap_entry *));
+	memset(zslots, 0, nslots * sizeof(struct zswap_entry *));
+	zbuf = malloc369(simpagesize);
+	list_init(&zswap_lru);
+	zswap_writeback = writeback;
+}
+
+static void zswap_remove(struct zswap_entry *e)
+{
+	zslots[e->offset / simpagesize] = NULL;
+	list_del(&e->lru_entry);
+	zswap_pool_bytes -= e->len;
+	--zswap_pool_pages;
+	free369(e);
+}
+
+static void zswap_decompress(struct zswap_entry *e, void *data)
+{
+	if (e->same) {
+		memset(data, e->data[0], simpagesize);
+	} else {
+		lz_decompress(e->data, e->len, data, simpagesize);
+	}
+}
+
+void zswap_destroy(void)
+{
+	while (list_first_entry(&zswap_lru) != &zswap_lru.head) {
+		zswap_remove(container_of(list_first_entry(&zswap_lru),
+		                          struct zswap_entry, lru_entry));
+	}
+	list_destroy(&zswap_lru);
+	free369(zslots);
+	free369(zbuf);
+}
+
+bool zswap_store(off_t offset, const void *data)
+{
+	// Any older copy of this slot is stale now
+	zswap_invalidate(offset);
+
+	const unsigned char *page = data;
+	size_t len;
+	bool same = true;
+	for (size_t i = 1; i < simpagesize; ++i) {
+		if (page[i] != page[0]) {
+			same = false;
+			break;
+		}
+	}
+	if (same) {
+		len = 1;
+		zbuf[0] = page[0];
+		++zswap_same_pages;
+	} else if ((len = lz_compress(page, simpagesize, zbuf, simpagesize)) == 0) {
+		++zswap_rejects;
+		return false;
+	}
+
+	struct zswap_entry *e = malloc369(sizeof(struct zswap_entry) + len);
+	e->offset = offset;
+	e->len = len;
+	e->same = same;
+	memcpy(e->data, zbuf, len);
+	list_add_tail(&zswap_lru, &e->lru_entry);
+	zslots[offset / simpagesize] = e;
+	++zswap_stores;
+	++zswap_pool_pages;
+	zswap_pool_bytes += len;
+	if (zswap_pool_bytes > zswap_pool_peak) {
+		zswap_pool_peak = zswap_pool_bytes;
+	}
+
+	// Spill least recently used pages to the swap file until we fit
+	while (zswap_pool_bytes > zswap_pool_limit) {
+		struct zswap_entry *victim = container_of(list_first_entry(&zswap_lru),
+		                                          struct zswap_entry, lru_entry);
+		zswap_decompress(victim, zbuf);
+		zswap_writeback(victim->offset, zbuf);
+		++zswap_spills;
+		zswap_remove(victim);
+	}
+	return true;
+}
+
+bool zswap_load(off_t offset, void *data)
+{
+	struct zswap_entry *e = zslots[offset / simpagesize];
+	if (!e) {
+		return false;
+	}
+	zswap_decompress(e, data);
+	list_del(&e->lru_entry);
+	list_add_tail(&zswap_lru, &e->lru_entry);
+	++zswap_loads;
+	return true;
+}
+
+void zswap_invalidate(off_t offset)
+{
+	struct zswap_entry *e = zslots[offset / simpagesize];
+	if (e) {
+		zswap_remove(e);
+	}
+}
+
+// Snapshots. Pool entries are saved in LRU order, so that restoring them
+// in the order they are read rebuilds the LRU list.
+void zswap_save(void)
+{
+	SNAP_WRITE(zswap_stores);
+	SNAP_WRITE(zswap_rejects);
+	SNAP_WRITE(zswap_same_pages);
+	SNAP_WRITE(zswap_loads);
+	SNAP_WRITE(zswap_spills);
+	SNAP_WRITE(zswap_pool_bytes);
+	SNAP_WRITE(zswap_pool_peak);
+	SNAP_WRITE(zswap_pool_pages);
+	list_entry *pos;
+	list_for_each(pos, &zswap_lru) {
+		struct zswap_entry *e = container_of(pos, struct zswap_entry, lru_entry);
+		SNAP_WRITE(e->offset);
+		SNAP_WRITE(e->len);
+		SNAP_WRITE(e->same);
+		snap_write(e->data, e->len);
+	}
+}
+
+void zswap_restore(void)
+{
+	SNAP_READ(zswap_stores);
+	SNAP_READ(zswap_rejects);
+	SNAP_READ(zswap_same_pages);
+	SNAP_READ(zswap_loads);
+	SNAP_READ(zswap_spills);
+	SNAP_READ(zswap_pool_bytes);
+	SNAP_READ(zswap_pool_peak);
+	SNAP_READ(zswap_pool_pages);
+	for (size_t i = 0; i < zswap_pool_pages; ++i) {
+		off_t offset;
+		size_t len;
+		SNAP_READ(offset);
+		SNAP_READ(len);
+		struct zswap_entry *e = malloc369(sizeof(struct zswap_entry) + len);
+		e->offset = offset;
+		e->len = len;
+		SNAP_READ(e->same);
+		snap_read(e->data, len);
+		list_add_tail(&zswap_lru, &e->lru_entry);
+		zslots[offset / simpagesize] = e;
+	}
+}
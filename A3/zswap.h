@@ -0,0 +1,45 @@
+#ifndef __ZSWAP_H__
+#define __ZSWAP_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Compressed in-memory swap cache. Pages written to swap are compressed
+// and kept in a bounded pool in memory. When the pool is full, the least
+// recently used pages are written out to the swap file. Pages that do not
+// compress are written to the swap file directly.
+
+// Size limit of the compressed pool in bytes. 0 disables the pool.
+// Must be set before calling swap_init().
+extern size_t zswap_pool_limit;
+
+// Counters for the compressed pool. Set in zswap.c, reported by sim.c
+extern size_t zswap_stores;     // pages stored in the pool
+extern size_t zswap_rejects;    // pages that did not compress
+extern size_t zswap_same_pages; // pages stored as a single repeated byte
+extern size_t zswap_loads;      // pageins served from the pool
+extern size_t zswap_spills;     // pages written back to the swap file
+extern size_t zswap_pool_bytes; // current pool occupancy
+extern size_t zswap_pool_peak;  // highest pool occupancy
+extern size_t zswap_pool_pages; // current number of pages in the pool
+
+// Set up the pool for a swap file with 'nslots' slots. 'writeback' is
+// called to write a page to the swap file when it is evicted from the pool.
+extern void zswap_init(size_t nslots,
+                       void (*writeback)(off_t offset, const void *data));
+extern void zswap_destroy(void);
+
+// Compress and store the page 'data' for swap slot 'offset'.
+// Return: true if the page is now in the pool, false if the page did not
+//         compress and has to be written to the swap file instead.
+extern bool zswap_store(off_t offset, const void *data);
+
+// Copy the page for swap slot 'offset' into 'data', if it is in the pool.
+// Return: true if the page was found in the pool, otherwise false.
+extern bool zswap_load(off_t offset, void *data);
+
+// Drop the page for swap slot 'offset' from the pool, if it is there.
+extern void zswap_invalidate(off_t offset);
+
+#endif /* __ZSWAP_H__ */
@@ -16,8 +16,76 @@
  * CSC369 Assignment 4 - File system runtime context implementation.
  */
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "fs_ctx.h"
 
+
+/** FNV-1a hash of a file name. */
+static size_t name_hash(const char *name)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (; *name != '\0'; name++) {
+		h = (h ^ (unsigned char)*name) * 0x100000001b3ULL;
+	}
+	return (size_t)h;
+}
+
+/** Returns true if blk is a data block number that the image could hold. */
+static bool valid_blk(fs_ctx *fs, vsfs_blk_t blk)
+{
+	return blk >= fs->sb->sb_data_region && blk < VSFS_BLK_MAX;
+}
+
+/** Add every entry in use in a root directory block to the index. */
+static void index_block(fs_ctx *fs, vsfs_blk_t blk)
+{
+	if (!valid_blk(fs, blk)) {
+		return;
+	}
+	vsfs_dentry *entries = (vsfs_dentry *)(fs->image + blk * VSFS_BLOCK_SIZE);
+	for (size_t i = 0; i < VSFS_BLOCK_SIZE / sizeof(vsfs_dentry); i++) {
+		if (entries[i].ino != VSFS_INO_MAX && entries[i].name[0] != '\0') {
+			fs_ctx_dir_insert(fs, &entries[i]);
+		}
+	}
+}
+
+/**
+ * Build the root directory index.
+ *
+ * There is one dentry per inode at most (plus "." and ".." for the root),
+ * so a table of twice that many slots never fills up and stays at most
+ * half full.
+ */
+static bool index_root(fs_ctx *fs)
+{
+	size_t max_entries = (size_t)fs->sb->sb_num_inodes + 2;
+	fs->dir_index_size = 1;
+	while (fs->dir_index_size < 2 * max_entries) {
+		fs->dir_index_size *= 2;
+	}
+	fs->dir_index = calloc(fs->dir_index_size, sizeof(vsfs_dentry *));
+	if (fs->dir_index == NULL) {
+		return false;
+	}
+
+	vsfs_inode *root_ino = &fs->itable[VSFS_ROOT_INO];
+	for (int n = 0; n < VSFS_NUM_DIRECT; n++) {
+		index_block(fs, root_ino->i_direct[n]);
+	}
+	if (valid_blk(fs, root_ino->i_indirect)) {
+		vsfs_blk_t *indirect_blocks =
+			(vsfs_blk_t *)(fs->image + root_ino->i_indirect * VSFS_BLOCK_SIZE);
+		for (size_t n = 0; n < VSFS_BLOCK_SIZE / sizeof(vsfs_blk_t); n++) {
+			index_block(fs, indirect_blocks[n]);
+		}
+	}
+	return true;
+}
+
 /**
  * Initialize file system context.
  * 
@@ -66,9 +134,8 @@ bool fs_ctx_init(fs_ctx *fs, void *image, size_t size)
 	 */
 	fs->itable = (vsfs_inode *)(image + VSFS_ITBL_BLKNUM * VSFS_BLOCK_SIZE);
 
-	// TODO: Initialize anything else that you add to the fs context.
-	
-	return true;
+	/** Root directory index, so path lookups don't scan every dentry */
+	return index_root(fs);
 }
 
 
@@ -80,6 +147,55 @@ bool fs_ctx_init(fs_ctx *fs, void *image, size_t size)
  */
 void fs_ctx_destroy(fs_ctx *fs)
 {
-	//TODO: cleanup any other resources allocated in fs_ctx_init()
-	(void)fs;
+	free(fs->dir_index);
+	fs->dir_index = NULL;
+}
+
+
+vsfs_dentry *fs_ctx_dir_lookup(fs_ctx *fs, const char *name)
+{
+	size_t mask = fs->dir_index_size - 1;
+	for (size_t i = name_hash(name) & mask; fs->dir_index[i] != NULL;
+	     i = (i + 1) & mask) {
+		if (strcmp(fs->dir_index[i]->name, name) == 0) {
+			return fs->dir_index[i];
+		}
+	}
+	return NULL;
+}
+
+void fs_ctx_dir_insert(fs_ctx *fs, vsfs_dentry *entry)
+{
+	size_t mask = fs->dir_index_size - 1;
+	size_t i = name_hash(entry->name) & mask;
+	while (fs->dir_index[i] != NULL) {
+		i = (i + 1) & mask;
+	}
+	fs->dir_index[i] = entry;
+}
+
+void fs_ctx_dir_remove(fs_ctx *fs, vsfs_dentry *entry)
+{
+	size_t mask = fs->dir_index_size - 1;
+	size_t i = name_hash(entry->name) & mask;
+	while (fs->dir_index[i] != entry) {
+		if (fs->dir_index[i] == NULL) {
+			return;
+		}
+		i = (i + 1) & mask;
+	}
+
+	// Shift later entries of the probe run back into the hole, so that
+	// lookups never stop early at an empty slot (no tombstones needed).
+	// An entry can fill the hole if the hole is no further from its home
+	// slot than where it is now.
+	fs->dir_index[i] = NULL;
+	for (size_t j = (i + 1) & mask; fs->dir_index[j] != NULL; j = (j + 1) & mask) {
+		size_t home = name_hash(fs->dir_index[j]->name) & mask;
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			fs->dir_index[i] = fs->dir_index[j];
+			fs->dir_index[j] = NULL;
+			i = j;
+		}
+	}
 }
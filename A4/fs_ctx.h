@@ -42,9 +42,14 @@ typedef struct fs_ctx {
 	bitmap_t *dbmap;
 	/** Pointer to the inode table in the mmap'd disk image */
 	vsfs_inode *itable;
-	
-	//TODO: other useful runtime state of the mounted file system should be
-	//       cached here (NOT in global variables in vsfs.c)
+	/**
+	 * Hash table index of the root directory, from name to the dentry in
+	 * the mmap'd disk image. Open addressing with linear probing; NULL
+	 * marks an empty slot.
+	 */
+	vsfs_dentry **dir_index;
+	/** Number of slots in dir_index, a power of 2. */
+	size_t dir_index_size;
 
 } fs_ctx;
 
@@ -64,3 +69,30 @@ bool fs_ctx_init(fs_ctx *fs, void *image, size_t size);
  * @param fs     pointer to the context to clean up
  */
 void fs_ctx_destroy(fs_ctx *fs);
+
+/**
+ * Find a root directory entry by name.
+ *
+ * @param fs    pointer to the file system context.
+ * @param name  file name, without the leading '/'.
+ * @return      pointer to the dentry in the image; NULL if not found.
+ */
+vsfs_dentry *fs_ctx_dir_lookup(fs_ctx *fs, const char *name);
+
+/**
+ * Add a root directory entry to the index.
+ * The dentry's name must be set, and must not already be in the index.
+ *
+ * @param fs     pointer to the file system context.
+ * @param entry  pointer to the dentry in the image.
+ */
+void fs_ctx_dir_insert(fs_ctx *fs, vsfs_dentry *entry);
+
+/**
+ * Remove a root directory entry from the index.
+ * Must be called before the dentry's name is cleared.
+ *
+ * @param fs     pointer to the file system context.
+ * @param entry  pointer to the dentry in the image.
+ */
+void fs_ctx_dir_remove(fs_ctx *fs, vsfs_dentry *entry);
@@ -116,37 +116,10 @@ static int path_lookup(const char *path,  vsfs_ino_t *ino) {
 
     // Since only one directory (root dir), no need to do parsing yay
     fs_ctx *fs = get_fs();
-    vsfs_inode *root_ino = &fs->itable[VSFS_ROOT_INO];
-
-    // Search in direct entries first
-    for (int n = 0; n < VSFS_NUM_DIRECT; n++) {
-        if (root_ino->i_direct[n] >= fs->sb->sb_data_region && root_ino->i_direct[n] < VSFS_BLK_MAX) {
-            vsfs_dentry *direct_entries = (vsfs_dentry *)(fs->image + root_ino->i_direct[n] * VSFS_BLOCK_SIZE);
-            for (size_t i = 0; i < VSFS_BLOCK_SIZE / sizeof(vsfs_dentry); i++) {
-                if (strcmp(direct_entries[i].name, path + 1) == 0) {
-                    *ino = direct_entries[i].ino;
-                    return 0;
-                }
-            }
-        }
-    }
-
-    // Search in indirect entries if it exists
-    if (root_ino->i_indirect >= fs->sb->sb_data_region && root_ino->i_indirect < VSFS_BLK_MAX){
-        vsfs_blk_t *indirect_blocks = (vsfs_blk_t *)(fs->image + root_ino->i_indirect * VSFS_BLOCK_SIZE);
-
-        // Search in every indirect block that exists
-        for (size_t n = 0; n < VSFS_BLOCK_SIZE/sizeof(vsfs_blk_t); n++){
-            if (indirect_blocks[n] >= fs->sb->sb_data_region && indirect_blocks[n] < VSFS_BLK_MAX){
-                vsfs_dentry *indirect_entries = (vsfs_dentry *)(fs->image + indirect_blocks[n] * VSFS_BLOCK_SIZE);
-                for (size_t i = 0; i < VSFS_BLOCK_SIZE / sizeof(vsfs_dentry); i++) {
-                    if (strcmp(indirect_entries[i].name, path + 1) == 0) {
-                        *ino = indirect_entries[i].ino;
-                        return 0;
-                    }
-                }
-            }
-        }
+    vsfs_dentry *entry = fs_ctx_dir_lookup(fs, path + 1);
+    if (entry != NULL) {
+        *ino = entry->ino;
+        return 0;
     }
 
 	return -ENOENT; // Not found
@@ -385,6 +358,7 @@ static int vsfs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
             if (root_entries[i].ino == VSFS_INO_MAX) {
                 root_entries[i].ino = index;
                 strncpy(root_entries[i].name, path + 1, VSFS_NAME_MAX - 1); // Does not copy the '/'
+                fs_ctx_dir_insert(fs, &root_entries[i]);
                 clock_gettime(CLOCK_REALTIME, &(root_ino->i_mtime));
                 return 0;
             }
@@ -426,6 +400,7 @@ static int vsfs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
             if (indirect_entries[i].ino == VSFS_INO_MAX) {
                 indirect_entries[i].ino = index;
                 strncpy(indirect_entries[i].name, path + 1, VSFS_NAME_MAX - 1); // Does not copy the '/'
+                fs_ctx_dir_insert(fs, &indirect_entries[i]);
                 clock_gettime(CLOCK_REALTIME, &(root_ino->i_mtime));
                 return 0;
             }
@@ -457,54 +432,18 @@ static int vsfs_unlink(const char *path)
 	fs_ctx *fs = get_fs();
     vsfs_inode *root_ino = &fs->itable[VSFS_ROOT_INO];
 
-    vsfs_ino_t to_free;
-
-    // Search in direct entries first
-    for (int n = 0; n < VSFS_NUM_DIRECT; n++) {
-        if (root_ino->i_direct[n] >= fs->sb->sb_data_region && root_ino->i_direct[n] < VSFS_BLK_MAX) {
-            vsfs_dentry *direct_entries = (vsfs_dentry *)(fs->image + root_ino->i_direct[n] * VSFS_BLOCK_SIZE);
-            for (size_t i = 0; i < VSFS_BLOCK_SIZE / sizeof(vsfs_dentry); i++) {
-                if (strcmp(direct_entries[i].name, path + 1) == 0) {
-                    memset(direct_entries[i].name, 0, VSFS_NAME_MAX);
-                    to_free = direct_entries[i].ino;
-                    bitmap_free(fs->ibmap, fs->sb->sb_num_inodes, direct_entries[i].ino);
-                    fs->sb->sb_free_inodes += 1;
-                    direct_entries[i].ino = VSFS_INO_MAX;
-                    root_ino->i_nlink -= 1;
-                    clock_gettime(CLOCK_REALTIME, &(root_ino->i_mtime));
-                    goto unlink_inode;
-                }
-            }
-        }
-    }
-
-    // Search in indirect entries if it exists
-    if (root_ino->i_indirect >= fs->sb->sb_data_region && root_ino->i_indirect < VSFS_BLK_MAX){
-        vsfs_blk_t *indirect_blocks = (vsfs_blk_t *)(fs->image + root_ino->i_indirect * VSFS_BLOCK_SIZE);
-
-        // Search in every indirect block that exists
-        for (size_t n = 0; n < VSFS_BLOCK_SIZE/sizeof(vsfs_blk_t); n++){
-            if (indirect_blocks[n] >= fs->sb->sb_data_region && indirect_blocks[n] < VSFS_BLK_MAX){
-                vsfs_dentry *indirect_entries = (vsfs_dentry *)(fs->image + indirect_blocks[n] * VSFS_BLOCK_SIZE);
-                for (size_t i = 0; i < VSFS_BLOCK_SIZE / sizeof(vsfs_dentry); i++) {
-                    if (strcmp(indirect_entries[i].name, path + 1) == 0) {
-                        memset(indirect_entries[i].name, 0, VSFS_NAME_MAX);
-                        to_free = indirect_entries[i].ino;
-                        bitmap_free(fs->ibmap, fs->sb->sb_num_inodes, indirect_entries[i].ino);
-                        fs->sb->sb_free_inodes += 1;
-                        indirect_entries[i].ino = VSFS_INO_MAX;
-                        root_ino->i_nlink -= 1;
-                        clock_gettime(CLOCK_REALTIME, &(root_ino->i_mtime));
-                        goto unlink_inode;
-                    }
-                }
-            }
-        }
+    vsfs_dentry *entry = fs_ctx_dir_lookup(fs, path + 1);
+    if (entry == NULL) {
+        return 0; // Shouldn't happen since path exists by assumption
     }
-
-    return 0;
-
-    unlink_inode:
+    vsfs_ino_t to_free = entry->ino;
+    fs_ctx_dir_remove(fs, entry);
+    memset(entry->name, 0, VSFS_NAME_MAX);
+    bitmap_free(fs->ibmap, fs->sb->sb_num_inodes, entry->ino);
+    fs->sb->sb_free_inodes += 1;
+    entry->ino = VSFS_INO_MAX;
+    root_ino->i_nlink -= 1;
+    clock_gettime(CLOCK_REALTIME, &(root_ino->i_mtime));
 
     vsfs_inode *ino = &fs->itable[to_free];
 
@@ -528,7 +467,7 @@ static int vsfs_unlink(const char *path)
         fs->sb->sb_free_blocks += 1;
     }
 
-	return 0; // Shouldn't get here since path exists by assumption
+	return 0;
 }
 
 